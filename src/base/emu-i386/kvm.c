@@ -42,6 +42,8 @@
 #include "dos2linux.h"
 #include "mapping.h"
 #include "sig.h"
+#include "port.h"
+#include "utilities.h"
 
 #ifndef X86_EFLAGS_FIXED
 #define X86_EFLAGS_FIXED 2
@@ -152,12 +154,79 @@ static struct kvm_cpuid2 *cpuid;
 static struct kvm_run *run;
 static int kvmfd, vmfd, vcpufd;
 static struct kvm_sregs sregs;
+/* registers are exchanged through run->s.regs instead of ioctls */
+static int kvm_sync_regs;
+#ifndef KVM_SYNC_X86_VALID_FIELDS
+#define KVM_SYNC_X86_REGS (1UL << 0)
+#define KVM_SYNC_X86_SREGS (1UL << 1)
+#endif
+#define KVM_SYNC_REGS (KVM_SYNC_X86_REGS | KVM_SYNC_X86_SREGS)
+/* writes to the emulated VGA window queued by the kernel without exiting */
+static struct kvm_coalesced_mmio_ring *mmio_ring;
+/* pages written by the guest, pushed by the kernel as (slot, offset) */
+#ifdef KVM_CAP_DIRTY_LOG_RING
+#define DIRTY_RING_ENTRIES 4096
+static struct kvm_dirty_gfn *dirty_ring;
+static unsigned dirty_ring_entries, dirty_ring_fetch;
+/* harvested dirty pages by guest physical page number */
+static unsigned long dirty_pages[(1U << (32 - PAGE_SHIFT)) / LONG_BIT];
+#endif
 
 #define MAXSLOT 400
 static struct kvm_userspace_memory_region maps[MAXSLOT];
 
 static int init_kvm_vcpu(void);
 
+/* Ports whose writes can be queued with $_kvm_fast_io: the guest can
+   not tell when they happen without reading some port, and any exit
+   replays the queue first. The speaker is not here as it is timed
+   by the guest. */
+static const struct {
+  ioport_t base;
+  unsigned len;
+} kvm_queued_ports[] = {
+  { 0x20, 1 },		/* master PIC command (EOI) */
+  { 0xa0, 1 },		/* slave PIC command (EOI) */
+  { 0x388, 4 },		/* OPL */
+  { 0x3c8, 2 },		/* VGA DAC write index and data */
+};
+
+static void init_kvm_queued_ports(void)
+{
+#ifdef KVM_CAP_COALESCED_PIO
+  int i, ret;
+
+  if (!config.kvm_fastio)
+    return;
+  ret = ioctl(kvmfd, KVM_CHECK_EXTENSION, KVM_CAP_COALESCED_PIO);
+  if (ret <= 0 || !mmio_ring) {
+    warn("KVM: coalesced PIO unsupported, $_kvm_fast_io ignored\n");
+    return;
+  }
+  for (i = 0; i < ARRAY_SIZE(kvm_queued_ports); i++) {
+    struct kvm_coalesced_mmio_zone zone = {
+      .addr = kvm_queued_ports[i].base,
+      .size = kvm_queued_ports[i].len,
+      .pio = 1,
+    };
+    unsigned port;
+
+    ret = ioctl(vmfd, KVM_REGISTER_COALESCED_MMIO, &zone);
+    if (ret == -1) {
+      perror("KVM: KVM_REGISTER_COALESCED_MMIO");
+      leavedos(99);
+      return;
+    }
+    /* let the instruction through to KVM instead of the monitor */
+    for (port = zone.addr; port < zone.addr + zone.size; port++)
+      monitor->io_bitmap[port >> 3] &= ~(1 << (port & 7));
+  }
+#else
+  if (config.kvm_fastio)
+    warn("KVM: coalesced PIO not compiled in, $_kvm_fast_io ignored\n");
+#endif
+}
+
 #if !defined(DISABLE_SYSTEM_WA) || !defined(KVM_CAP_IMMEDIATE_EXIT)
 
 /* compat functions for older complex method of immediate exit
@@ -315,6 +384,7 @@ static void init_kvm_monitor(void)
     leavedos(99);
     return;
   }
+  init_kvm_queued_ports();
 
   ret = ioctl(vcpufd, KVM_GET_SREGS, &sregs);
   if (ret == -1) {
@@ -446,6 +516,23 @@ static int init_kvm_vcpu(void)
     return 0;
   }
 
+#ifdef KVM_CAP_DIRTY_LOG_RING
+  /* the ring has to be enabled before the vcpu is created and
+     replaces KVM_GET_DIRTY_LOG */
+  ret = ioctl(kvmfd, KVM_CHECK_EXTENSION, KVM_CAP_DIRTY_LOG_RING);
+  if (ret > 0) {
+    struct kvm_enable_cap cap = { .cap = KVM_CAP_DIRTY_LOG_RING };
+    unsigned entries = DIRTY_RING_ENTRIES;
+    while (entries * sizeof(struct kvm_dirty_gfn) > ret)
+      entries /= 2;
+    cap.args[0] = entries * sizeof(struct kvm_dirty_gfn);
+    if (ioctl(vmfd, KVM_ENABLE_CAP, &cap) == 0)
+      dirty_ring_entries = entries;
+    else
+      perror("KVM: KVM_ENABLE_CAP KVM_CAP_DIRTY_LOG_RING");
+  }
+#endif
+
   vcpufd = ioctl(vmfd, KVM_CREATE_VCPU, (unsigned long)0);
   if (vcpufd == -1) {
     perror("KVM: KVM_CREATE_VCPU");
@@ -484,6 +571,33 @@ static int init_kvm_vcpu(void)
     return 0;
   }
   run->exit_reason = KVM_EXIT_INTR;
+
+#ifdef KVM_SYNC_X86_VALID_FIELDS
+  ret = ioctl(kvmfd, KVM_CHECK_EXTENSION, KVM_CAP_SYNC_REGS);
+  if (ret > 0 && (ret & KVM_SYNC_REGS) == KVM_SYNC_REGS) {
+    /* have the kernel store the registers into run->s.regs on every exit */
+    run->kvm_valid_regs = KVM_SYNC_REGS;
+    kvm_sync_regs = 1;
+  }
+#endif
+
+  ret = ioctl(kvmfd, KVM_CHECK_EXTENSION, KVM_CAP_COALESCED_MMIO);
+  if (ret > 0)
+    mmio_ring = (struct kvm_coalesced_mmio_ring *)((char *)run +
+						   ret * PAGE_SIZE);
+
+#ifdef KVM_CAP_DIRTY_LOG_RING
+  if (dirty_ring_entries) {
+    dirty_ring = mmap(NULL, dirty_ring_entries * sizeof(*dirty_ring),
+		      PROT_READ | PROT_WRITE, MAP_SHARED, vcpufd,
+		      KVM_DIRTY_LOG_PAGE_OFFSET * PAGE_SIZE);
+    if (dirty_ring == MAP_FAILED) {
+      perror("KVM: mmap dirty ring");
+      return 0;
+    }
+    Q_printf("KVM: using dirty ring with %u entries\n", dirty_ring_entries);
+  }
+#endif
   return 1;
 }
 
@@ -585,9 +699,44 @@ kvm_get_memory_region(dosaddr_t dosaddr, dosaddr_t size)
   return ret;
 }
 
+/* Move the pages collected in the dirty ring to dirty_pages. This has
+   to be done while the slot numbers still match maps[], so on every
+   exit and before the memory slots change. */
+static void kvm_harvest_dirty_ring(void)
+{
+#ifdef KVM_CAP_DIRTY_LOG_RING
+  int harvested = 0;
+
+  if (!dirty_ring)
+    return;
+  for (;;) {
+    struct kvm_dirty_gfn *e =
+      &dirty_ring[dirty_ring_fetch & (dirty_ring_entries - 1)];
+    unsigned slot;
+
+    if (!(__atomic_load_n(&e->flags, __ATOMIC_ACQUIRE) &
+	  KVM_DIRTY_GFN_F_DIRTY))
+      break;
+    slot = e->slot & 0xffff;
+    if (slot < MAXSLOT)
+      set_bit((maps[slot].guest_phys_addr >> PAGE_SHIFT) + e->offset,
+	      dirty_pages);
+    __atomic_store_n(&e->flags, KVM_DIRTY_GFN_F_RESET, __ATOMIC_RELEASE);
+    dirty_ring_fetch++;
+    harvested = 1;
+  }
+  if (harvested && ioctl(vmfd, KVM_RESET_DIRTY_RINGS, 0) == -1) {
+    perror("KVM: KVM_RESET_DIRTY_RINGS");
+    leavedos_main(99);
+  }
+#endif
+}
+
 static void set_kvm_memory_region(struct kvm_userspace_memory_region *region)
 {
   int ret;
+
+  kvm_harvest_dirty_ring();
   Q_printf("KVM: map slot=%d flags=%d dosaddr=0x%08llx size=0x%08llx unixaddr=0x%llx\n",
 	   region->slot, region->flags, region->guest_phys_addr,
 	   region->memory_size, region->userspace_addr);
@@ -755,6 +904,17 @@ void kvm_set_mmio(dosaddr_t base, dosaddr_t size, int on)
     }
     set_kvm_memory_region(p);
     p->memory_size = region_size;
+    /* only reads need to exit synchronously, the writes are queued
+       in the coalesced MMIO ring and replayed on the next exit */
+    if (mmio_ring) {
+      struct kvm_coalesced_mmio_zone zone = { .addr = base, .size = size };
+      int ret = ioctl(vmfd, on ? KVM_REGISTER_COALESCED_MMIO :
+		      KVM_UNREGISTER_COALESCED_MMIO, &zone);
+      if (ret == -1) {
+	perror("KVM: KVM_(UN)REGISTER_COALESCED_MMIO");
+	leavedos_main(99);
+      }
+    }
   }
 }
 
@@ -783,6 +943,20 @@ void kvm_get_dirty_map(dosaddr_t base, unsigned char *bitmap)
     kvm_get_memory_region(base, PAGE_SIZE);
 
   assert(p->flags & KVM_MEM_LOG_DIRTY_PAGES);
+#ifdef KVM_CAP_DIRTY_LOG_RING
+  if (dirty_ring) {
+    unsigned int first = base >> PAGE_SHIFT;
+    unsigned int i, pages = ((p->guest_phys_addr + p->memory_size) >>
+			     PAGE_SHIFT) - first;
+
+    kvm_harvest_dirty_ring();
+    memset(bitmap, 0, (pages + CHAR_BIT - 1) / CHAR_BIT);
+    for (i = 0; i < pages; i++)
+      if (test_and_clear_bit(first + i, dirty_pages))
+	set_bit(i, bitmap);
+    return;
+  }
+#endif
   dirty_log.slot = p->slot;
   dirty_log.dirty_bitmap = bitmap;
   ioctl(vmfd, KVM_GET_DIRTY_LOG, &dirty_log);
@@ -1014,9 +1188,18 @@ void kvm_leave(int pm)
   }
 }
 
-static int kvm_post_run(struct vm86_regs *regs, struct kvm_regs *kregs)
+static void kvm_get_regs(struct kvm_regs *kregs)
 {
-  int ret = ioctl(vcpufd, KVM_GET_REGS, kregs);
+  int ret;
+
+#ifdef KVM_SYNC_X86_VALID_FIELDS
+  if (kvm_sync_regs) {
+    *kregs = run->s.regs.regs;
+    sregs = run->s.regs.sregs;
+    return;
+  }
+#endif
+  ret = ioctl(vcpufd, KVM_GET_REGS, kregs);
   if (ret == -1) {
     perror("KVM: KVM_GET_REGS");
     leavedos_main(99);
@@ -1026,6 +1209,71 @@ static int kvm_post_run(struct vm86_regs *regs, struct kvm_regs *kregs)
     perror("KVM: KVM_GET_SREGS");
     leavedos_main(99);
   }
+}
+
+/* dirty is a mask of KVM_SYNC_X86_REGS and KVM_SYNC_X86_SREGS */
+static void kvm_set_regs(struct kvm_regs *kregs, int dirty)
+{
+  int ret;
+
+#ifdef KVM_SYNC_X86_VALID_FIELDS
+  if (kvm_sync_regs) {
+    if (dirty & KVM_SYNC_X86_REGS)
+      run->s.regs.regs = *kregs;
+    if (dirty & KVM_SYNC_X86_SREGS)
+      run->s.regs.sregs = sregs;
+    run->kvm_dirty_regs |= dirty;
+    return;
+  }
+#endif
+  if (dirty & KVM_SYNC_X86_REGS) {
+    ret = ioctl(vcpufd, KVM_SET_REGS, kregs);
+    if (ret == -1) {
+      perror("KVM: KVM_SET_REGS");
+      leavedos_main(99);
+    }
+  }
+  if (dirty & KVM_SYNC_X86_SREGS) {
+    ret = ioctl(vcpufd, KVM_SET_SREGS, &sregs);
+    if (ret == -1) {
+      perror("KVM: KVM_SET_SREGS");
+      leavedos_main(99);
+    }
+  }
+}
+
+/* which register classes of regs differ from the ones in saved */
+static int kvm_dirty_regs(const struct vm86_regs *regs,
+			  const struct vm86_regs *saved)
+{
+  int dirty = 0;
+
+  if (regs->eax != saved->eax || regs->ebx != saved->ebx ||
+      regs->ecx != saved->ecx || regs->edx != saved->edx ||
+      regs->esi != saved->esi || regs->edi != saved->edi ||
+      regs->ebp != saved->ebp || regs->esp != saved->esp ||
+      regs->eip != saved->eip || regs->eflags != saved->eflags)
+    dirty |= KVM_SYNC_X86_REGS;
+  if (regs->cs != saved->cs || regs->ss != saved->ss ||
+      ((regs->eflags ^ saved->eflags) & X86_EFLAGS_VM))
+    dirty |= KVM_SYNC_X86_SREGS;
+  else if (regs->eflags & X86_EFLAGS_VM) {
+    if (regs->ds != saved->ds || regs->es != saved->es ||
+	regs->fs != saved->fs || regs->gs != saved->gs)
+      dirty |= KVM_SYNC_X86_SREGS;
+  } else {
+    if (regs->__null_ds != saved->__null_ds ||
+	regs->__null_es != saved->__null_es ||
+	regs->__null_fs != saved->__null_fs ||
+	regs->__null_gs != saved->__null_gs)
+      dirty |= KVM_SYNC_X86_SREGS;
+  }
+  return dirty;
+}
+
+static int kvm_post_run(struct vm86_regs *regs, struct kvm_regs *kregs)
+{
+  kvm_get_regs(kregs);
   /* don't interrupt GDT code */
   if (!(kregs->rflags & X86_EFLAGS_VM) && !(sregs.cs.selector & 4)) {
     g_printf("KVM: interrupt in GDT code, resuming\n");
@@ -1064,6 +1312,67 @@ static int kvm_post_run(struct vm86_regs *regs, struct kvm_regs *kregs)
   return 1;
 }
 
+static void kvm_mmio_write(dosaddr_t addr, unsigned char *data, int len)
+{
+  switch(len) {
+  case 1: write_byte(addr, data[0]); break;
+  case 2: write_word(addr, *(uint16_t*)data); break;
+  case 4: write_dword(addr, *(uint32_t*)data); break;
+  case 8: write_qword(addr, *(uint64_t*)data); break;
+  }
+}
+
+static void kvm_port_write(ioport_t port, unsigned char *data, int len)
+{
+  switch(len) {
+  case 1: port_outb(port, data[0]); break;
+  case 2: port_outw(port, *(uint16_t*)data); break;
+  case 4: port_outd(port, *(uint32_t*)data); break;
+  }
+}
+
+/* KVM_EXIT_IO: a port let through by init_kvm_queued_ports() is read,
+   or written while the ring is full */
+static void kvm_port_io(void)
+{
+  unsigned char *data = (unsigned char *)run + run->io.data_offset;
+  int i;
+
+  for (i = 0; i < run->io.count; i++, data += run->io.size) {
+    if (run->io.direction == KVM_EXIT_IO_OUT) {
+      kvm_port_write(run->io.port, data, run->io.size);
+      continue;
+    }
+    switch(run->io.size) {
+    case 1: data[0] = port_inb(run->io.port); break;
+    case 2: *(uint16_t*)data = port_inw(run->io.port); break;
+    case 4: *(uint32_t*)data = port_ind(run->io.port); break;
+    }
+  }
+}
+
+/* Replay the VGA and port writes the kernel queued since the last
+   exit. This has to happen before anything else sees the emulated
+   hardware, i.e. on every return from KVM_RUN. */
+static void kvm_flush_coalesced_mmio(void)
+{
+  struct kvm_coalesced_mmio_ring *ring = mmio_ring;
+
+  if (!ring)
+    return;
+  while (ring->first != ring->last) {
+    struct kvm_coalesced_mmio *m = &ring->coalesced_mmio[ring->first];
+#ifdef KVM_CAP_COALESCED_PIO
+    if (m->pio)
+      kvm_port_write(m->phys_addr, m->data, m->len);
+    else
+#endif
+      kvm_mmio_write(m->phys_addr, m->data, m->len);
+    __sync_synchronize();
+    ring->first = (ring->first + 1) % KVM_COALESCED_MMIO_MAX;
+  }
+}
+
 /* Inner loop for KVM, runs until HLT or signal */
 static unsigned int kvm_run(void)
 {
@@ -1071,14 +1380,15 @@ static unsigned int kvm_run(void)
   struct kvm_regs kregs = {};
   static struct vm86_regs saved_regs;
   struct vm86_regs *regs = &monitor->regs;
+  int dirty = 0;
 
-  if (run->exit_reason != KVM_EXIT_HLT &&
-      memcmp(regs, &saved_regs, sizeof(*regs))) {
+  if (run->exit_reason != KVM_EXIT_HLT)
+    dirty = kvm_dirty_regs(regs, &saved_regs);
+  if (dirty) {
     /* Only set registers if changes happened, usually
        this means a hardware interrupt or sometimes
-       a callback, and also for the very first call to boot */
-    int ret;
-
+       a callback, and also for the very first call to boot.
+       Only the classes that changed are passed to the vcpu. */
     kregs.rax = regs->eax;
     kregs.rbx = regs->ebx;
     kregs.rcx = regs->ecx;
@@ -1089,11 +1399,6 @@ static unsigned int kvm_run(void)
     kregs.rsp = regs->esp;
     kregs.rip = regs->eip;
     kregs.rflags = regs->eflags;
-    ret = ioctl(vcpufd, KVM_SET_REGS, &kregs);
-    if (ret == -1) {
-      perror("KVM: KVM_SET_REGS");
-      leavedos_main(99);
-    }
 
     if (regs->eflags & X86_EFLAGS_VM) {
       set_vm86_seg(&sregs.cs, regs->cs);
@@ -1110,18 +1415,17 @@ static unsigned int kvm_run(void)
       set_ldt_seg(&sregs.gs, regs->__null_gs);
       set_ldt_seg(&sregs.ss, regs->ss);
     }
-    ret = ioctl(vcpufd, KVM_SET_SREGS, &sregs);
-    if (ret == -1) {
-      perror("KVM: KVM_SET_SREGS");
-      leavedos_main(99);
-    }
+    kvm_set_regs(&kregs, dirty);
   }
 
   while (!exit_reason) {
     int ret = ioctl(vcpufd, KVM_RUN, NULL);
     int errn = errno;
 
-    /* KVM should only exit for four reasons:
+    kvm_flush_coalesced_mmio();
+    kvm_harvest_dirty_ring();
+
+    /* KVM should only exit for five reasons:
        1. KVM_EXIT_HLT: at the hlt in kvmmon.S following an exception.
           In this case the registers are pushed on and popped from the stack.
        2. KVM_EXIT_INTR: (with ret==-1) after a signal. In this case we
@@ -1132,6 +1436,9 @@ static unsigned int kvm_run(void)
           possible, then it exits with this code. This only happens if a signal
           occurs during execution of the monitor code in kvmmon.S.
        4. KVM_EXIT_MMIO: when attempting to write to ROM or r/w from/to MMIO
+          (writes to the VGA window only if the coalesced MMIO ring is full)
+       5. KVM_EXIT_IO: with $_kvm_fast_io for the ports that are not
+          trapped by the monitor, see init_kvm_queued_ports()
     */
     if (ret != 0 && ret != -1)
       error("KVM: strange return %i, errno=%i\n", ret, errn);
@@ -1164,12 +1471,7 @@ static unsigned int kvm_run(void)
 	dosaddr_t addr = (dosaddr_t)run->mmio.phys_addr;
 	unsigned char *data = run->mmio.data;
 	if (run->mmio.is_write) {
-	  switch(run->mmio.len) {
-	  case 1: write_byte(addr, data[0]); break;
-	  case 2: write_word(addr, *(uint16_t*)data); break;
-	  case 4: write_dword(addr, *(uint32_t*)data); break;
-	  case 8: write_qword(addr, *(uint64_t*)data); break;
-	  }
+	  kvm_mmio_write(addr, data, run->mmio.len);
 	} else {
 	  switch(run->mmio.len) {
 	  case 1: data[0] = read_byte(addr); break;
@@ -1179,10 +1481,13 @@ static unsigned int kvm_run(void)
 	  }
 	}
 	ret = ioctl(vcpufd, KVM_RUN, NULL);
+	errn = errno;
+	kvm_flush_coalesced_mmio();
+	kvm_harvest_dirty_ring();
 	/* read-modify-write instructions give two KVM_EXIT_MMIO
 	   exits in a row before the signal exit */
       } while (ret == 0 && run->exit_reason == KVM_EXIT_MMIO);
-      assert(ret == -1 && errno == EINTR);
+      assert(ret == -1 && errn == EINTR);
       kvm_set_immediate_exit(0);
       /* going to emulate some instructions */
       if (!kvm_post_run(regs, &kregs))
@@ -1190,6 +1495,15 @@ static unsigned int kvm_run(void)
       saved_regs = *regs;
       exit_reason = KVM_EXIT_MMIO;
       break;
+    case KVM_EXIT_IO:
+      /* served right here, KVM_RUN completes the instruction */
+      kvm_port_io();
+      break;
+#ifdef KVM_CAP_DIRTY_LOG_RING
+    case KVM_EXIT_DIRTY_RING_FULL:
+      /* already harvested above, just re-enter */
+      break;
+#endif
     case KVM_EXIT_IRQ_WINDOW_OPEN:
       run->request_interrupt_window = !run->ready_for_interrupt_injection;
       if (run->request_interrupt_window || !run->if_flag) break;
@@ -339,6 +339,87 @@ void FlagSync_All (void)
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+/*
+ * Bulk REP MOVS/STOS. When all pages of a run are plain RAM (found in or
+ * entered into the unprotected page cache of dos2linux.c) the run is
+ * done with memmove/memset, one page at a time, instead of one
+ * accessor call per element. The destination is invalidated once for
+ * the whole range. VGA memory, protected or uncommitted pages, and
+ * overlaps where the element order shows fall back to the loops.
+ */
+static int bulk_range(dosaddr_t addr, unsigned int len, int write)
+{
+	dosaddr_t a, last = addr + len - 1;
+
+	if (last < addr)
+		return 0;
+	if (write)
+		e_invalidate(addr, len);
+	for (a = addr & _PAGE_MASK; ; a += PAGE_SIZE) {
+		if (!dosaddr_to_unixaddr_unprotected(a, 1)) {
+			if (vga_write_access(a))
+				return 0;
+			cache_unprotected_page(a);
+			if (!dosaddr_to_unixaddr_unprotected(a, 1))
+				return 0;
+		}
+		if (a == (last & _PAGE_MASK))
+			break;
+	}
+	return 1;
+}
+
+/* dest and src are the lowest addresses of the runs */
+static int bulk_movs(dosaddr_t dest, dosaddr_t src, unsigned int len, int df)
+{
+	if (df > 0 ? (dest > src && dest - src < len) :
+		     (dest < src && src - dest < len))
+		return 0;
+	if (!bulk_range(src, len, 0) || !bulk_range(dest, len, 1))
+		return 0;
+	while (len) {
+		unsigned int n = len;
+		if (df > 0) {
+			n = min(n, PAGE_SIZE - (dest & ~_PAGE_MASK));
+			n = min(n, PAGE_SIZE - (src & ~_PAGE_MASK));
+			MEMMOVE_DOS2DOS(dest, src, n);
+			dest += n;
+			src += n;
+		} else {
+			dosaddr_t de = dest + len, se = src + len;
+			n = min(n, de - ((de - 1) & _PAGE_MASK));
+			n = min(n, se - ((se - 1) & _PAGE_MASK));
+			MEMMOVE_DOS2DOS(de - n, se - n, n);
+		}
+		len -= n;
+	}
+	return 1;
+}
+
+static int bulk_stos(dosaddr_t dest, unsigned int len, uint32_t v, int size)
+{
+	unsigned int phase = 0;
+
+	if (!bulk_range(dest, len, 1))
+		return 0;
+	while (len) {
+		unsigned int n = min(len, PAGE_SIZE - (dest & ~_PAGE_MASK));
+		if (size == 1)
+			MEMSET_DOS(dest, v, n);
+		else {
+			unsigned char *p = LINEAR2UNIX(dest);
+			unsigned int k;
+			for (k = 0; k < n; k++)
+				p[k] = v >> (((phase + k) & (size - 1)) << 3);
+		}
+		phase += n;
+		dest += n;
+		len -= n;
+	}
+	return 1;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 
 void InitGen_sim(void)
@@ -2295,6 +2376,7 @@ void Gen_sim(int op, int mode, ...)
 		int df = (CPUWORD(Ofs_FLAGS) & EFLAGS_DF? -1:1);
 		dosaddr_t src, dest;
 		register unsigned int i;
+		unsigned int n;
 		i = TR1.d;
 		GTRACE4("O_MOVS_MovD",0xff,0xff,df,i);
 		if(i == 0)
@@ -2339,7 +2421,15 @@ void Gen_sim(int op, int mode, ...)
 		}
 		dest = AR1.d;
 		src = AR2.d;
-		if (df<0) {
+		n = i * OPSIZE(mode);
+		if (n / OPSIZE(mode) == i &&
+		    (df<0 ? bulk_movs(dest - n + OPSIZE(mode),
+				      src - n + OPSIZE(mode), n, df) :
+			    bulk_movs(dest, src, n, df))) {
+		    dest += df * n;
+		    src += df * n;
+		}
+		else if (df<0) {
 		    if (mode&MBYTE) {
 			while (i--) write_byte(dest--, read_byte(src--));
 		    }
@@ -2398,6 +2488,7 @@ void Gen_sim(int op, int mode, ...)
 		int df = (CPUWORD(Ofs_FLAGS) & EFLAGS_DF? -1:1);
 		dosaddr_t addr;
 		register unsigned int i;
+		unsigned int n;
 		i = TR1.d;
 		GTRACE4("O_MOVS_StoD",0xff,0xff,df,i);
 		if((mode & ADDR16) && i) {
@@ -2431,7 +2522,13 @@ void Gen_sim(int op, int mode, ...)
 		    }
 		}
 		addr = AR1.d;
-		if (mode&MBYTE) {
+		n = i * OPSIZE(mode);
+		if (n && n / OPSIZE(mode) == i &&
+		    bulk_stos(df<0 ? addr - n + OPSIZE(mode) : addr, n,
+			      DR1.d, OPSIZE(mode))) {
+		    addr += df * n;
+		}
+		else if (mode&MBYTE) {
 		    while (i--) { write_byte(addr, DR1.b.bl); addr += df; }
 		}
 		else if (mode&DATA16) {
@@ -117,6 +117,7 @@
 #ifdef HOST_ARCH_X86
 #include "codegen-x86.h"
 #include "cpatch.h"
+#include "pcache.h"
 
 static void Gen_x86(int op, int mode, ...);
 static void AddrGen_x86(int op, int mode, ...);
@@ -125,6 +126,10 @@ static unsigned int CloseAndExec_x86(unsigned int PC, int mode);
 hitimer_u TimeStartExec;
 static TNode *LastXNode = NULL;
 
+/* see PushF() in codegen-x86.h */
+unsigned char *FlagsPushed, *FlagsBarrier;
+int FlagsElided = 0;
+
 /////////////////////////////////////////////////////////////////////////////
 
 #define	Offs_From_Arg()		(char)(va_arg(ap,int))
@@ -195,11 +200,21 @@ static unsigned char *CodeGen(unsigned char *CodePtr, unsigned char *BaseGenBuf,
 	unsigned char * CpTemp;
 	int mode = IG->mode;
 	int rcod;
+	unsigned char *FlagsLive = FlagsPushed;
 #if PROFILE
 	hitimer_t t0 = 0;
 	if (debug_level('e')) t0 = GETTSC();
 #endif
 
+	/* only these leave the host flags alone */
+	switch(IG->op) {
+	case L_NOP: case L_REG: case S_REG: case L_REG2REG: case S_DI_R:
+	case L_IMM: case L_IMM_R1: case L_MOVZS: case L_ZXAX:
+		break;
+	default:
+		FlagsPushed = NULL;
+	}
+
 	switch(IG->op) {
 	case A_DI_0:			// base(32), imm
 		// movl $imm,%%edi
@@ -487,14 +502,15 @@ static unsigned char *CodeGen(unsigned char *CodePtr, unsigned char *BaseGenBuf,
 	case O_DEC_R:
 		rcod = 0x08fe;
 arith0:		{
-		G1(POPdx,Cp);	// get flags from stack into %%edx
 		switch (IG->op) {
 		case O_ADC_R: // tests carry
 		case O_SBB_R: // tests carry
 		case O_INC_R: // preserves carry
 		case O_DEC_R: // preserves carry
-			// shr $1,%%edx to get carry flag from stack
-			G2M(0xd1,0xea,Cp);
+			PopCarry(Cp);	// get carry flag from stack
+			break;
+		default:
+			PopDX(Cp);	// ignore flags from stack
 		}
 		if (mode & MBYTE) {
 			if (mode & IMMED) {
@@ -518,11 +534,12 @@ arith0:		{
 				G2(0x4301|rcod,Cp); G1(IG->p0,Cp);
 			}
 		}
-		G1(PUSHF,Cp);	// flags back on stack
+		PushF(Cp);	// flags back on stack
 		}
 		break;
 	case O_CLEAR:
-		G3M(POPdx,0x31,0xc0,Cp);	//ignore flags; xorl %%eax,%%eax
+		PopDX(Cp);	// ignore flags
+		G2M(0x31,0xc0,Cp);	// xorl %%eax,%%eax
 		if (mode & MBYTE) {
 			// movb %%al,offs(%%ebx)
 			G3M(0x88,0x43,IG->p0,Cp);
@@ -531,10 +548,10 @@ arith0:		{
 			// mov{wl} %%{e}ax,offs(%%ebx)
 			Gen66(mode,Cp); G3M(0x89,0x43,IG->p0,Cp);
 		}
-		G1(PUSHF,Cp);	// new flags on stack
+		PushF(Cp);	// new flags on stack
 		break;
 	case O_TEST:
-		G1(POPdx,Cp);			// ignore flags
+		PopDX(Cp);			// ignore flags
 		if (mode & MBYTE) {
 			// testb $0xff,offs(%%ebx)
 			G4M(0xf6,0x43,IG->p0,0xffu,Cp);
@@ -547,13 +564,13 @@ arith0:		{
 			// test $0xffffffff,offs(%%ebx)
 			G3M(0xf7,0x43,IG->p0,Cp); G4(0xffffffff,Cp);
 		}
-		G1(PUSHF,Cp);	// new flags on stack
+		PushF(Cp);	// new flags on stack
 		break;
 	case O_SBSELF:
 		// if CY=0 -> reg=0,  flag=xx46
 		// if CY=1 -> reg=-1, flag=xx97
 		// pop %%edx; shr $1,%%edx to get carry flag from stack
-		G3M(POPdx,0xd1,0xea,Cp);
+		PopCarry(Cp);
 		// sbbl %%eax,%%eax
 		G2M(0x19,0xc0,Cp);
 		if (mode & MBYTE) {
@@ -564,7 +581,7 @@ arith0:		{
 			// mov{wl} %%{e}ax,offs(%%ebx)
 			Gen66(mode,Cp); G3M(0x89,0x43,IG->p0,Cp);
 		}
-		G1(PUSHF,Cp);	// flags back on stack
+		PushF(Cp);	// flags back on stack
 		break;
 	case O_ADD_FR:
 		rcod = ADDbfrm; /* 0x00 */ goto arith1;
@@ -583,11 +600,10 @@ arith0:		{
 	case O_CMP_FR:
 		rcod = CMPbfrm; /* 0x38 */
 arith1:
-		G1(POPdx,Cp);	// get flags from stack into %%edx
-		if (IG->op == O_ADC_FR || IG->op == O_SBB_FR) {
-			// shr $1,%%edx to get carry flag from stack
-			G2M(0xd1,0xea,Cp);
-		}
+		if (IG->op == O_ADC_FR || IG->op == O_SBB_FR)
+			PopCarry(Cp);	// get carry flag from stack
+		else
+			PopDX(Cp);	// ignore flags from stack
 		if (mode & MBYTE) {
 			if (mode & IMMED) {
 				// OPb $immed,offs(%%ebx)
@@ -611,7 +627,7 @@ arith1:
 				G2(0x4301|rcod,Cp); G1(IG->p0,Cp);
 			}
 		}
-		G1(PUSHF,Cp);	// flags back on stack
+		PushF(Cp);	// flags back on stack
 		break;
 	case O_NOT:
 		if (mode & MBYTE) {
@@ -625,7 +641,7 @@ arith1:
 		}
 		break;
 	case O_NEG:
-		G1(POPdx,Cp);	// ignore flags from stack
+		PopDX(Cp);	// ignore flags from stack
 		if (mode & MBYTE) {
 			// negb %%al
 			G2M(0xf6,0xd8,Cp);
@@ -635,12 +651,10 @@ arith1:
 			Gen66(mode,Cp);
 			G2M(0xf7,0xd8,Cp);
 		}
-		G1(PUSHF,Cp);	// new flags on stack
+		PushF(Cp);	// new flags on stack
 		break;
 	case O_INC:
-		G1(POPdx,Cp);	// get flags from stack into %%edx
-		// shr $1,%%edx to get preserved carry flag from stack
-		G2M(0xd1,0xea,Cp);
+		PopCarry(Cp);	// get preserved carry flag from stack
 		if (mode & MBYTE) {
 			// incb %%al
 			G2M(0xfe,0xc0,Cp);
@@ -661,12 +675,10 @@ arith1:
 			G1(0x40,Cp);
 #endif
 		}
-		G1(PUSHF,Cp);	// flags back on stack before writing
+		PushF(Cp);	// flags back on stack before writing
 		break;
 	case O_DEC:
-		G1(POPdx,Cp);	// get flags from stack into %%edx
-		// shr $1,%%edx to get preserved carry flag from stack
-		G2M(0xd1,0xea,Cp);
+		PopCarry(Cp);	// get preserved carry flag from stack
 		if (mode & MBYTE) {
 			// decb %%al
 			G2M(0xfe,0xc8,Cp);
@@ -687,10 +699,10 @@ arith1:
 			G1(0x48,Cp);
 #endif
 		}
-		G1(PUSHF,Cp);	// flags back on stack
+		PushF(Cp);	// flags back on stack
 		break;
 	case O_CMPXCHG: {
-		G1(POPdx,Cp);	// ignore flags from stack
+		PopDX(Cp);	// ignore flags from stack
 		if (mode & MBYTE) {
 			// movb offs1(%%ebx),%%dl
 			G3M(0x8a,0x53,IG->p0,Cp);
@@ -719,7 +731,7 @@ arith1:
 			// mov{wl} %%{e}cx,%%{e}ax
 			Gen66(mode,Cp); G2M(0x89,0xc8,Cp);
 		} }
-		G1(PUSHF,Cp);	// flags back on stack
+		PushF(Cp);	// flags back on stack
 		break;
 	case O_XCHG: {
 		if (mode & MBYTE) {
@@ -741,7 +753,7 @@ arith1:
 		}
 		break;
 	case O_MUL:
-		G1(POPF,Cp);	// get flags from stack
+		PopF(Cp);	// get flags from stack
 		if (mode & MBYTE) {
 			// mulb Ofs_AL(%%ebx),%%al
 			G3M(0xf6,0x63,Ofs_AL,Cp);
@@ -764,10 +776,10 @@ arith1:
 			// movl %%edx,Ofs_EDX(%%ebx)
 			G3M(0x89,0x53,Ofs_EDX,Cp);
 		}
-		G1(PUSHF,Cp);	// flags back on stack
+		PushF(Cp);	// flags back on stack
 		break;
 	case O_IMUL:
-		G1(POPF,Cp);	// get flags from stack
+		PopF(Cp);	// get flags from stack
 		if (mode & MBYTE) {
 			if ((mode&(IMMED|DATA16))==(IMMED|DATA16)) {
 				// imul $immed,%%ax,%%ax
@@ -833,7 +845,7 @@ arith1:
 				G3M(0x89,0x53,Ofs_EDX,Cp);
 			}
 		}
-		G1(PUSHF,Cp);	// flags back on stack
+		PushF(Cp);	// flags back on stack
 		break;
 
 	case O_DIV: {
@@ -880,7 +892,7 @@ arith1:
 			// movl %%edx,Ofs_EDX(%%ebx)
 			G3M(0x89,0x53,Ofs_EDX,Cp);
 		}
-		G1(PUSHF,Cp);	// flags back on stack
+		PushF(Cp);	// flags back on stack
 		}
 		break;
 	case O_IDIV: {
@@ -927,7 +939,7 @@ arith1:
 			// movl %%edx,Ofs_EDX(%%ebx)
 			G3M(0x89,0x53,Ofs_EDX,Cp);
 		}
-		G1(PUSHF,Cp);	// flags back on stack
+		PushF(Cp);	// flags back on stack
 		}
 		break;
 
@@ -991,7 +1003,7 @@ arith1:
 	case O_SAR:
 		rcod = 0x38;
 shrot0:
-		G1(0x9d,Cp);	// get flags from stack
+		PopF(Cp);	// get flags from stack
 		if (mode & MBYTE) {
 			// op al,1:	d0 c0+r
 			// op al,n:	c0 c0+r	n
@@ -1027,7 +1039,7 @@ shrot0:
 				G1(0xd3,Cp); G1(0xc0 | rcod,Cp);
 			}
 		}
-		G1(0x9c,Cp);	// flags back on stack
+		PushF(Cp);	// flags back on stack
 		break;
 
 	case O_OPAX: {	/* used by DAA,DAS,AAA,AAS,AAM,AAD */
@@ -2069,7 +2081,7 @@ shrot0:
 		break;
 	case O_BITOP: {
 		unsigned char n = IG->p0;
-		G1(0x9d,Cp);	// get flags from stack
+		PopF(Cp);	// get flags from stack
 		switch (n) {
 		case 0x03: /* BT */
 		case 0x0b: /* BTS */
@@ -2119,12 +2131,12 @@ shrot0:
 			Gen66(mode,Cp);	G4M(0x0f,0xba,(n|0xc0),IG->p1,Cp);
 			break;
 		}
-		G1(0x9c,Cp);	// flags back on stack
+		PushF(Cp);	// flags back on stack
 		} break;
 
 	case O_SHFD: {
 		unsigned char l_r = IG->p0;
-		G1(0x9d,Cp);	// get flags from stack
+		PopF(Cp);	// get flags from stack
 		// mov{wl} offs(%%ebx),%%{e}dx
 		Gen66(mode,Cp);	G3M(0x8b,0x53,IG->p1,Cp);
 		if (mode & IMMED) {
@@ -2138,7 +2150,7 @@ shrot0:
 			// sh{lr}d %%cl,%%{e}dx,%%{e}ax
 			Gen66(mode,Cp);	G3M(0x0f,(0xa5|l_r),0xd0,Cp);
 		}
-		G1(0x9c,Cp);	// flags back on stack
+		PushF(Cp);	// flags back on stack
 		} break;
 
 	case O_RDTSC: {
@@ -2833,6 +2845,8 @@ static CodeBuf *ProduceCode(unsigned int PC, IMeta *I0)
 	/* actual code buffer starts from here */
 	BaseGenBuf = CodePtr = (unsigned char *)&GenCodeBuf->meta[nap];
 	I0->daddr = 0;
+	/* the flags are on the stack when entering a node */
+	FlagsPushed = FlagsBarrier = NULL;
 	if (debug_level('e')>1)
 	    e_printf("CodeBuf=%p siz %zd CodePtr=%p\n",GenCodeBuf,GenBufSize,CodePtr);
 
@@ -2847,6 +2861,7 @@ static CodeBuf *ProduceCode(unsigned int PC, IMeta *I0)
 	    }
 	    cp = cp1 = CodePtr;
 	    I->daddr = cp - BaseGenBuf;
+	    FlagsBarrier = cp;
 	    for (j=0; j<I->ngen; j++) {
 		CodePtr = CodeGen(CodePtr, BaseGenBuf, I, j);
 		if (CodePtr-cp1 > MAX_GEND_BYTES_PER_OP) {
@@ -3001,6 +3016,7 @@ static void NodeLinker(TNode *LG, TNode *G)
 		    }
 		    *lp = ra;
 		    L->t_ref = &G->mblock->bkptr;
+		    NodeLinks++;
 		    B = calloc(1,sizeof(backref));
 		    // head insertion
 		    B->next = T->bkr.next;
@@ -3052,6 +3068,7 @@ static void NodeLinker(TNode *LG, TNode *G)
 			}
 			*lp = ra;
 			L->nt_ref = &G->mblock->bkptr;
+			NodeLinks++;
 			B = calloc(1,sizeof(backref));
 			// head insertion
 			B->next = T->bkr.next;
@@ -3276,6 +3293,8 @@ static unsigned int CloseAndExec_x86(unsigned int PC, int mode)
 	e_mprotect(G->seqbase, G->seqlen);
 	G->cs = LONG_CS;
 	G->mode = mode;
+	/* save it while the code is still unlinked */
+	pcache_store(G);
 	/* check links INSIDE current node */
 	NodeLinker(G, G);
 	return Exec_x86(G);
@@ -3374,6 +3393,8 @@ unsigned int Exec_x86(TNode *G)
 	hitimer_u TimeStartExec, TimeEndExec;
 #endif
 
+	G->execs++;
+	NodeEntries++;
 	ecpu = CPUOFFS(0);
 	if (debug_level('e')>1) {
 		if (TheCPU.sigalrm_pending>0) e_printf("** SIGALRM is pending\n");
@@ -3384,14 +3405,20 @@ unsigned int Exec_x86(TNode *G)
 	fprintf(aLog,"%p: exec\n",G->key);
 #endif
 	if (seqflg & F_FPOP) {
+		int loaded = 0;
 		if (TheCPU.fpstate) {
 			loadfpstate(*TheCPU.fpstate);
 			TheCPU.fpstate = NULL;
+			loaded = 1;
 		}
 		/* mask exceptions in generated code */
 		unsigned short fpuc;
-		asm ("fstcw	%0" : "=m"(TheCPU.fpuc));
-		fpuc = TheCPU.fpuc | 0x3f;
+		asm ("fstcw	%0" : "=m"(fpuc));
+		/* unless just loaded, the host precision may be forced */
+		if (!loaded && config.cpuemu_fastfpu)
+			fpuc = (fpuc & ~FPUC_PC) | (TheCPU.fpuc & FPUC_PC);
+		TheCPU.fpuc = fpuc;
+		fpuc = FPUC_HOST(TheCPU.fpuc | 0x3f);
 		asm ("fldcw	%0" :: "m"(fpuc));
 	}
 
@@ -3462,8 +3489,8 @@ unsigned int Exec_x86(TNode *G)
 	}
 
 #if defined(SINGLESTEP)
-	InvalidateNodeRange(G->key, 1, NULL);
-	avltr_delete(G->key);
+	InvalidateNodeRange(G->key, 1, NULL, INV_CODE);
+	tdir_delete(G->key);
 	if (debug_level('e')>1) e_printf("\n%s",e_print_regs());
 #else
 	/*
@@ -3501,6 +3528,8 @@ unsigned int Exec_x86_fast(TNode *G)
 	unsigned mode = G->mode;
 
 	do {
+		G->execs++;
+		NodeEntries++;
 		ePC = Exec_x86_asm(&mem_ref, &flg, ecpu, G->addr);
 		if (G->alive > 0) {
 			if (LastXNode->clink.unlinked_jmp_targets &&
@@ -3514,7 +3543,8 @@ unsigned int Exec_x86_fast(TNode *G)
 			break;
 		}
 	} while (!TheCPU.err && (G=FindTree(ePC)) &&
-		 GoodNode(G, mode) && !(G->flags & (F_FPOP|F_INHI)));
+		 GoodNode(G, mode) && !(G->flags & (F_FPOP|F_INHI)) &&
+		 G->execs != HOT_TRACE);
 
 	Exec_x86_post(flg, mem_ref);
 	TheCPU.sigalrm_pending = 0;
@@ -73,6 +73,36 @@ extern unsigned int Exec_x86_fast(TNode *G);
 #define PopPushF(Cp)	if (((Cp)==BaseGenBuf)||((Cp)[-1]!=PUSHF)) \
 				G2(0x9c9d,(Cp))
 
+/* Lazy flags.
+ * The guest flags live on the host stack between ops: an op that uses
+ * them pops them and pushes the new ones when done. Since PUSHF leaves
+ * the host EFLAGS alone, the flags it pushed are also still in EFLAGS
+ * as long as only flag-neutral moves were emitted after it (FlagsPushed
+ * is reset by everything else). In that case the popf becomes a plain
+ * pop, the carry needs no extraction from the stack copy and a PUSHF
+ * immediately followed by a pop within the same instruction is dropped
+ * as a whole. A pair is never dropped across an instruction boundary
+ * (FlagsBarrier): the Addr2Pc entry of an instruction is where BreakNode
+ * and the fault handler expect the flags on the stack.
+ */
+#define PushF(Cp)	{ G1(PUSHF,(Cp)); FlagsPushed = (Cp); }
+#define DropPushF(Cp)	{ (Cp)--; FlagsPushed = NULL; FlagsElided++; }
+#define FlagsDroppable(Cp) ((Cp) == FlagsLive && (Cp) != FlagsBarrier)
+// popf, or discard them if the host flags are the same
+#define PopF(Cp)	do { if (FlagsDroppable(Cp)) DropPushF(Cp) \
+			  else if (FlagsLive) { G1(POPdx,(Cp)); FlagsElided++; } \
+			  else G1(POPF,(Cp)); } while (0)
+// discard flags from stack
+#define PopDX(Cp)	do { if (FlagsDroppable(Cp)) DropPushF(Cp) \
+			  else G1(POPdx,(Cp)); } while (0)
+// pop %edx; shr $1,%edx to get carry flag from stack
+#define PopCarry(Cp)	do { if (FlagsDroppable(Cp)) DropPushF(Cp) \
+			  else if (FlagsLive) { G1(POPdx,(Cp)); FlagsElided++; } \
+			  else G3M(POPdx,0xd1,0xea,(Cp)); } while (0)
+
+extern unsigned char *FlagsPushed, *FlagsBarrier;
+extern int FlagsElided;
+
 // cld; btl $0xa,EFLAGS(%ebx); jnc 1f; std; 1f:
 #define GetDF(Cp)		\
   G4M(CLD,TwoByteESC,0xba,0x63,Cp);	\
@@ -36,15 +36,33 @@
 #include "trees.h"
 #include "codegen-arch.h"
 #include "cpatch.h"
+#include "../dosext/dpmi/msdos/msdos_ldt.h"
 
 #ifdef HOST_ARCH_X86
 
 static int in_cpatch;
 
+/*
+ * An instruction stays patched after its first fault, so all its later
+ * writes come here even when they go to ordinary RAM. Such pages are
+ * entered in the unprotected page cache of dos2linux.c (which mapping
+ * changes invalidate), and a hit there is written to directly.
+ */
+int CTlbHits = 0;
+
+static void ctlb_fill(dosaddr_t addr)
+{
+	if (vga_write_access(addr) || msdos_ldt_access(addr))
+		return;
+	cache_unprotected_page(addr);
+}
+
 /*
  * Return address of the stub function is passed into eip
+ * Returns 1 if only data is hit in a protected DPMI page, the caller
+ * has to write it with e_writedata() or e_opendata().
  */
-void m_munprotect(unsigned int addr, unsigned int len, unsigned char *eip)
+int m_munprotect(unsigned int addr, unsigned int len, unsigned char *eip)
 {
 	if (debug_level('e')>1) {
 		if (debug_level('e')>3)
@@ -57,17 +75,21 @@ void m_munprotect(unsigned int addr, unsigned int len, unsigned char *eip)
 		if (e_querymark(addr, len))
 			// no need to invalidate the whole page here,
 			// as the page does not need to be unprotected
-			InvalidateNodeRange(addr,len,eip);
-		return;
+			InvalidateNodeRange(addr,len,eip,INV_PATCH);
+		return 0;
 	}
-	/* Always unprotect and clear all code in the pages
+	/* only data is hit in a DPMI page holding code: keep the code */
+	if (e_dataonly(addr, len))
+		return 1;
+	/* Otherwise unprotect and clear all code in the pages
 	 * for DPMI data and code
 	 * Maybe the stub was set up before that code was parsed.
 	 * Clear that code */
 /*	if (UnCpatch((void *)(eip-3))) leavedos_main(0); */
 	len = PAGE_ALIGN(addr+len-1) - (addr & _PAGE_MASK);
 	addr &= _PAGE_MASK;
-	InvalidateNodeRange(addr,len,eip);
+	InvalidateNodeRange(addr,len,eip,INV_PATCH);
+	return 0;
 }
 
 #define repmovs(std,letter,cld)			       \
@@ -102,6 +124,8 @@ void rep_movs_stos(struct rep_stack *stack)
 	unsigned char *edi;
 	unsigned char op;
 	unsigned int size;
+	dosaddr_t daddr;
+	int data;
 
 	in_cpatch++;
 	assert(InCompiledCode);
@@ -118,8 +142,10 @@ void rep_movs_stos(struct rep_stack *stack)
 	else if (*eip & 1)
 		size = 4;
 	len *= size;
-	m_munprotect(addr - ((EFLAGS & EFLAGS_DF) ? (len - size) : 0),
-		     len, eip);
+	daddr = addr - ((EFLAGS & EFLAGS_DF) ? (len - size) : 0);
+	data = m_munprotect(daddr, len, eip);
+	if (data)
+		e_opendata(daddr, len);
 	edi = LINEAR2UNIX(addr);
 	if ((op & 0xfe) == 0xa4) { /* movs */
 		dosaddr_t source = DOSADDR_REL(stack->esi);
@@ -211,6 +237,8 @@ void rep_movs_stos(struct rep_stack *stack)
 	stack->edi = MEM_BASE32(addr);
 	stack->ecx = ecx;
 done:
+	if (data)
+		e_closedata(daddr, len);
 	InCompiledCode++;
 	in_cpatch--;
 }
@@ -219,71 +247,131 @@ done:
 
 void stk_16(dosaddr_t addr, Bit16u value)
 {
+	void *uaddr;
+
+	if ((uaddr = dosaddr_to_unixaddr_unprotected(addr, 2))) {
+		UNIX_WRITE_WORD(uaddr, value);
+		CTlbHits++;
+		return;
+	}
 	in_cpatch++;
 	assert(InCompiledCode);
 	InCompiledCode--;
-	e_invalidate(addr, 2);
-	WRITE_WORD(addr, value);
+	if (e_dataonly(addr, 2)) {
+		e_writedata(addr, &value, 2);
+	} else {
+		e_invalidate(addr, 2);
+		WRITE_WORD(addr, value);
+		ctlb_fill(addr);
+	}
 	InCompiledCode++;
 	in_cpatch--;
 }
 
 void stk_32(dosaddr_t addr, Bit32u value)
 {
+	void *uaddr;
+
+	if ((uaddr = dosaddr_to_unixaddr_unprotected(addr, 4))) {
+		UNIX_WRITE_DWORD(uaddr, value);
+		CTlbHits++;
+		return;
+	}
 	in_cpatch++;
 	assert(InCompiledCode);
 	InCompiledCode--;
-	e_invalidate(addr, 4);
-	WRITE_DWORD(addr, value);
+	if (e_dataonly(addr, 4)) {
+		e_writedata(addr, &value, 4);
+	} else {
+		e_invalidate(addr, 4);
+		WRITE_DWORD(addr, value);
+		ctlb_fill(addr);
+	}
 	InCompiledCode++;
 	in_cpatch--;
 }
 
 void wri_8(dosaddr_t addr, Bit8u value, unsigned char *eip)
 {
+	int data;
+	void *uaddr;
+
+	if ((uaddr = dosaddr_to_unixaddr_unprotected(addr, 1))) {
+		UNIX_WRITE_BYTE(uaddr, value);
+		CTlbHits++;
+		return;
+	}
 	in_cpatch++;
 	assert(InCompiledCode);
 	InCompiledCode--;
-	m_munprotect(addr, 1, eip);
+	data = m_munprotect(addr, 1, eip);
 	InCompiledCode++;
 	if (!emu_ldt_write(addr, value, 1)) {
 		if (vga_write_access(addr))
 			vga_write(addr, value);
+		else if (data)
+			e_writedata(addr, &value, 1);
 		else
 			WRITE_BYTE(addr,value);
 	}
+	if (!data)
+		ctlb_fill(addr);
 	in_cpatch--;
 }
 
 void wri_16(dosaddr_t addr, Bit16u value, unsigned char *eip)
 {
+	int data;
+	void *uaddr;
+
+	if ((uaddr = dosaddr_to_unixaddr_unprotected(addr, 2))) {
+		UNIX_WRITE_WORD(uaddr, value);
+		CTlbHits++;
+		return;
+	}
 	in_cpatch++;
 	assert(InCompiledCode);
 	InCompiledCode--;
-	m_munprotect(addr, 2, eip);
+	data = m_munprotect(addr, 2, eip);
 	InCompiledCode++;
 	if (!emu_ldt_write(addr, value, 2)) {
 		if (vga_write_access(addr))
 			vga_write_word(addr, value);
+		else if (data)
+			e_writedata(addr, &value, 2);
 		else
 			WRITE_WORD(addr,value);
 	}
+	if (!data)
+		ctlb_fill(addr);
 	in_cpatch--;
 }
 
 void wri_32(dosaddr_t addr, Bit32u value, unsigned char *eip)
 {
+	int data;
+	void *uaddr;
+
+	if ((uaddr = dosaddr_to_unixaddr_unprotected(addr, 4))) {
+		UNIX_WRITE_DWORD(uaddr, value);
+		CTlbHits++;
+		return;
+	}
 	in_cpatch++;
 	assert(InCompiledCode);
 	InCompiledCode--;
-	m_munprotect(addr, 4, eip);
+	data = m_munprotect(addr, 4, eip);
 	InCompiledCode++;
 	if (!emu_ldt_write(addr, value, 4)) {
 		if (vga_write_access(addr))
 			vga_write_dword(addr, value);
+		else if (data)
+			e_writedata(addr, &value, 4);
 		else
 			WRITE_DWORD(addr,value);
 	}
+	if (!data)
+		ctlb_fill(addr);
 	in_cpatch--;
 }
 
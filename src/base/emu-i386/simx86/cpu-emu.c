@@ -35,6 +35,7 @@
 #ifdef X86_EMULATOR
 #include <stdlib.h>
 #include <string.h>		/* for memset */
+#include <stdarg.h>
 #include <sys/time.h>
 #include <fenv.h>
 #include "emu.h"
@@ -480,6 +481,16 @@ char *showmode(unsigned int m)
  * A - Real and VM86 mode
  */
 
+/* save the FPU of the generated code as the guest's */
+static void e_savefpstate(void)
+{
+  savefpstate(vm86_fpu_state);
+  /* the host precision may be forced, keep the guest's one */
+  if (config.cpuemu_fastfpu)
+    vm86_fpu_state.cwd = (vm86_fpu_state.cwd & ~FPUC_PC) |
+	(TheCPU.fpuc & FPUC_PC);
+}
+
 /*
  * Enter emulator in VM86 mode (sys_vm86)
  */
@@ -570,7 +581,7 @@ void Cpu2Reg (void)
 
   if (TheCPU.fpstate == NULL) {
     if (!CONFIG_CPUSIM)
-      savefpstate(vm86_fpu_state);
+      e_savefpstate();
     else
       fp87_save_except();
     fesetenv(&dosemu_fenv);
@@ -650,7 +661,7 @@ static void Cpu2Scp (cpuctx_t *scp, int trapno)
   if (!TheCPU.err) _err = 0;		//???
   if (TheCPU.fpstate == NULL) {
     if (!CONFIG_CPUSIM)
-      savefpstate(vm86_fpu_state);
+      e_savefpstate();
     else
       fp87_save_except();
     /* there is no real need to save and restore the FPU state of the
@@ -846,10 +857,59 @@ void enter_cpu_emu(void)
 	iniflag = 1;
 }
 
+#ifdef HOST_ARCH_X86
+/*
+ * Code cache statistics. Printed on exit, and queried at runtime
+ * by the debugger's "jit" command.
+ */
+void e_cache_stats(void (*print)(const char *, ...))
+{
+	static const char *causes[INV_CAUSES] = {
+		[INV_WRITE] = "write", [INV_PATCH] = "patch",
+		[INV_FAULT] = "fault", [INV_REMAP] = "remap",
+		[INV_CODE] = "code",
+	};
+	int i;
+
+	print("Code cache nodes  %16d\n", ninodes);
+	print("Code cache bytes  %16lu", CodeCacheBytes);
+	if (config.cpuemu_cachesize)
+		print(" (limit %dk)", config.cpuemu_cachesize);
+	print("\n");
+	print("Code cache hits   %16d\n", CodeCacheHits);
+	print("Code cache misses %16d\n", CodeCacheMisses);
+	print("Code cache evictions %13d\n", CodeCacheEvictions);
+	for (i = 0; i < INV_CAUSES; i++)
+		print("Invalidated (%s) %*d\n", causes[i],
+		      (int)(19 - strlen(causes[i])), NodesInvalidated[i]);
+}
+
+static void dbug_print(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vlog_printf(10, fmt, args);
+	va_end(args);
+}
+#endif
+
 static void print_statistics(void)
 {
 	dbug_printf("Total cpuemu time %16lld us (incl.trace)\n",
 		    (long long)TotalTime/config.CPUSpeedInMhz);
+#ifdef HOST_ARCH_X86
+	if (!config.cpusim) {
+		dbug_printf("Node entries      %16d\n",NodeEntries);
+		dbug_printf("Node links        %16d\n",NodeLinks);
+		dbug_printf("Hot traces built  %16d\n",TracesBuilt);
+		dbug_printf("Cold blocks run   %16d\n",ColdBlocks);
+		dbug_printf("Flag syncs elided %16d\n",FlagsElided);
+		dbug_printf("Invalidations avoided %12d\n",InvalidationsAvoided);
+		dbug_printf("Write TLB hits    %16d\n",CTlbHits);
+		e_cache_stats(dbug_print);
+	}
+#endif
 #if PROFILE
 	dbug_printf("Total codgen time %16lld us\n",
 		    (long long)GenTime/config.CPUSpeedInMhz);
@@ -863,9 +923,9 @@ static void print_statistics(void)
 		    (long long)SearchTime/config.CPUSpeedInMhz);
 	dbug_printf("Total clean  time %16lld us\n",
 		    (long long)CleanupTime/config.CPUSpeedInMhz);
-	dbug_printf("Max tree nodes    %16d\n",MaxNodes);
+	dbug_printf("Max nodes         %16d\n",MaxNodes);
 	dbug_printf("Max node size     %16d\n",MaxNodeSize);
-	dbug_printf("Max tree depth    %16d\n",MaxDepth);
+	dbug_printf("Max nodes on page %16u\n",MaxPageNodes);
 	dbug_printf("Nodes parsed      %16d\n",TotalNodesParsed);
 	dbug_printf("Find misses       %16d\n",NodesNotFound);
 	dbug_printf("Nodes executed    %16d\n",TotalNodesExecd);
@@ -881,7 +941,7 @@ static void print_statistics(void)
 	}
 	dbug_printf("Page faults       %16d\n",PageFaults);
 	dbug_printf("Signals received  %16d\n",EmuSignals);
-	dbug_printf("Tree cleanups     %16d\n",TreeCleanups);
+	dbug_printf("Index cleanups    %16d\n",TreeCleanups);
 #endif
 }
 
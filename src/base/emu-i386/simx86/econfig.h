@@ -52,7 +52,6 @@
 #undef	ASM_DUMP
 #define ASM_DUMP_FILE	"/DOS/asmdump.log"
 
-#define AVL_MAX_HEIGHT	20
 #undef	DEBUG_TREE
 #define DEBUG_TREE_FILE	"/DOS/treedump.log"
 
@@ -69,6 +68,13 @@
 #define NODELIFE(n)	200
 #define CLEAN_SPEED(n)	(((n)<<2)+1)
 #define AGENODE		CreationIndex
+/* a node entered HOT_TRACE times from C is retranslated together with
+ * the node its final jmp leads to, if that one has no other entries */
+#define HOT_TRACE	64
+#define TRACE_MAXLEN	0x1000
+/* a block is interpreted the first COLD_RUNS times it is reached and
+ * only translated after that */
+#define COLD_RUNS	2
 
 #undef	TRAP_RETRACE
 
@@ -56,6 +56,13 @@ extern hitimer_t GenTime, LinkTime;
 #define CONFIG_CPUSIM 1
 #endif
 
+/* host x87 control word for a guest one: with $_cpuemu_fast_fpu the
+ * precision control is forced to double, the guest's is kept in
+ * TheCPU.fpuc */
+#define FPUC_PC		0x300
+#define FPUC_HOST(c)	(config.cpuemu_fastfpu ? \
+			 (((c) & ~FPUC_PC) | 0x200) : (c))
+
 /* octal digits in a byte: hhmm.mlll */
 #define D_HO(b)	(((b)>>6)&3)
 #define D_MO(b)	(((b)>>3)&7)
@@ -691,6 +698,8 @@ extern int Running;		/* into interpreter loop */
 extern unsigned int mMaxMem;
 extern int UseLinker;
 extern int PageFaults;
+extern int InvalidationsAvoided;
+extern int CTlbHits;
 
 extern volatile int CEmuStat;
 extern volatile int InCompiledCode;
@@ -729,7 +738,11 @@ int e_markpage(unsigned int addr, size_t len);
 int e_unmarkpage(unsigned int addr, size_t len);
 int e_querymark(unsigned int addr, size_t len);
 int e_querymark_all(unsigned int addr, size_t len);
-void m_munprotect(unsigned int addr, unsigned int len, unsigned char *eip);
+int e_dataonly(unsigned int addr, size_t len);
+void e_writedata(unsigned int addr, const void *src, size_t len);
+void e_opendata(unsigned int addr, size_t len);
+void e_closedata(unsigned int addr, size_t len);
+int m_munprotect(unsigned int addr, unsigned int len, unsigned char *eip);
 void mprot_init(void);
 void mprot_end(void);
 void InitGenCodeBuf(void);
@@ -121,6 +121,15 @@ void fp87_set_rounding(void)
 	case 0x800: fesetround(FE_UPWARD); break;
 	default:    fesetround(FE_TOWARDZERO); break;
 	}
+#ifdef HOST_ARCH_X86
+	/* long double arithmetic is done by the host x87 */
+	if (config.cpuemu_fastfpu) {
+		unsigned short fpuc;
+		asm ("fnstcw	%0" : "=m"(fpuc));
+		fpuc = FPUC_HOST(fpuc);
+		asm ("fldcw	%0" :: "m"(fpuc));
+	}
+#endif
 }
 
 static void fxam(long double d)
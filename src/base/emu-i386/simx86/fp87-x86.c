@@ -205,6 +205,12 @@ fp_mem:
 		G2(0xc189,Cp);
 		// orb 0x3f,al
 		G2(0x3f0c,Cp);
+		if (config.cpuemu_fastfpu) {
+			// andb ~3,ah
+			G3(0xfce480,Cp);
+			// orb 2,ah
+			G3(0x02cc80,Cp);
+		}
 		// movw	ax,FPUC(ebx)
 		G3(0x438966,Cp); G1(Ofs_FPUC,Cp);
 		// fldcw FPUC(ebx)
@@ -218,6 +224,12 @@ fp_mem:
 		G2(0x4b8a,Cp); G1(Ofs_FPUC,Cp);
 		// andb 0x3f,cl
 		G3(0x3fe180,Cp);
+		if (config.cpuemu_fastfpu) {
+			// movb FPUC+1(ebx),ch
+			G2(0x6b8a,Cp); G1(Ofs_FPUC+1,Cp);
+			// andb 3,ch
+			G3(0x03e580,Cp);
+		}
 		// fstcw FPUC(ebx)
 		G2(0x7bd9,Cp); G1(Ofs_FPUC,Cp);
 		// movw	FPUC(ebx),ax
@@ -226,6 +238,12 @@ fp_mem:
 		G2(0xc024,Cp);
 		// orb cl,al
 		G2(0xc808,Cp);
+		if (config.cpuemu_fastfpu) {
+			// andb ~3,ah
+			G3(0xfce480,Cp);
+			// orb ch,ah
+			G2(0xec08,Cp);
+		}
 		// movw	ax,FPUC(ebx)
 		G3(0x438966,Cp); G1(Ofs_FPUC,Cp);
 		// movw ax,(edi,ebp,1)
@@ -351,7 +369,17 @@ fp_mem:
 		   case 3:		/* FINIT */
 			// movw	0x37f,FPUC(ebx)
 			G3M(0x66,0xc7,0x43,Cp); G1(Ofs_FPUC,Cp); G2(0x37f,Cp);
-			goto fp_op;
+			if (!config.cpuemu_fastfpu)
+				goto fp_op;
+			// fninit
+			G2M(0xdb,0xe3,Cp);
+			// movw	0x27f,FPUC(ebx)
+			G3M(0x66,0xc7,0x43,Cp); G1(Ofs_FPUC,Cp); G2(0x27f,Cp);
+			// fldcw FPUC(ebx)
+			G2(0x6bd9,Cp); G1(Ofs_FPUC,Cp);
+			// movw	0x37f,FPUC(ebx)
+			G3M(0x66,0xc7,0x43,Cp); G1(Ofs_FPUC,Cp); G2(0x37f,Cp);
+			break;
 		   default: /* FNENI,FNDISI: 8087 */
 			    /* FSETPM,FRSTPM: 80287 */
 			goto fp_ok;	// do nothing
@@ -416,7 +444,7 @@ static int Fp87_op_x86_sim(int exop, int reg)
 		        memcpy(&q, p, (exop == 0x21 ? 14 : 94));
 			TheCPU.fpuc = q.fpuc;
 			/* mask exceptions in real FPU control word */
-			q.fpuc |= 0x3f;
+			q.fpuc = FPUC_HOST(q.fpuc | 0x3f);
 			if (exop==0x21)
 			    __asm__ __volatile__ ("data16 fldenv %0\n" :: "m"(q));
 			else
@@ -427,7 +455,7 @@ static int Fp87_op_x86_sim(int exop, int reg)
 		        memcpy(&q, p, (exop == 0x21 ? 28 : 108));
 			TheCPU.fpuc = q.fpuc;
 			/* mask exceptions in real FPU control word */
-			q.fpuc |= 0x3f;
+			q.fpuc = FPUC_HOST(q.fpuc | 0x3f);
 			if (exop==0x21)
 			    __asm__ __volatile__ ("fldenv	%0\n" :: "m"(q));
 			else
@@ -489,7 +517,8 @@ static int Fp87_op_x86_sim(int exop, int reg)
 			    __asm__ __volatile__ ("data16 fnstenv %0\n":"=m"(*p));
 			else
 			    __asm__ __volatile__ ("fnstenv	%0\n" : "=m"(*p));
-			p->fpuc = (p->fpuc & ~0x3f) | (TheCPU.fpuc & 0x3f);
+			p->fpuc = (p->fpuc & ~(FPUC_PC|0x3f)) |
+				(TheCPU.fpuc & (FPUC_PC|0x3f));
 		    }
 		    else {
 			struct float_env32 *p = (struct float_env32 *)LINEAR2UNIX(TheCPU.mem_ref);
@@ -497,12 +526,17 @@ static int Fp87_op_x86_sim(int exop, int reg)
 			    __asm__ __volatile__ ("data16 fnsave %0\n" : "=m"(*p));
 			else
 			    __asm__ __volatile__ ("fnsave	%0\n" : "=m"(*p));
-			p->fpuc = (p->fpuc & ~0x3f) | (TheCPU.fpuc & 0x3f);
+			p->fpuc = (p->fpuc & ~(FPUC_PC|0x3f)) |
+				(TheCPU.fpuc & (FPUC_PC|0x3f));
 		    }
 		    TheCPU.fpuc |= 0x3f;
 		    if (exop==0x35) {
 			TheCPU.fpuc = 0x37f;
 			__asm__ __volatile__ ("fninit");
+			if (config.cpuemu_fastfpu) {
+			    unsigned short fpuc = FPUC_HOST(TheCPU.fpuc);
+			    __asm__ __volatile__ ("fldcw	%0\n" :: "m"(fpuc));
+			}
 		    }
 		   }
 		   break;
@@ -36,6 +36,9 @@
 #include <string.h>
 #include "emu86.h"
 #include "codegen-arch.h"
+#ifdef HOST_ARCH_X86
+#include "pcache.h"
+#endif
 #include "port.h"
 #include "emudpmi.h"
 #include "mhpdbg.h"
@@ -80,8 +83,10 @@ static unsigned int DoCloseAndExec(unsigned int PC, int mode)
     if (!CONFIG_CPUSIM) {
 	unsigned P0 = InstrMeta[0].npc;
 	if (e_querymark(P0, PC - P0))
-	    InvalidateNodeRange(P0, PC - P0, NULL);
+	    InvalidateNodeRange(P0, PC - P0, NULL, INV_CODE);
     }
+    /* a hot trace retranslation ends with its node */
+    TraceJmp = TraceTarget = 0;
 #endif
     return CloseAndExec(PC, mode);
 }
@@ -307,6 +312,21 @@ static unsigned int _JumpGen(unsigned int P2, int mode, int opc,
 		    TheCPU.eip = d_t;
 		    return j_t;
 		}
+#endif
+#if !defined(SINGLESTEP) && defined(HOST_ARCH_X86)
+		if (!CONFIG_CPUSIM && P2 == TraceJmp) {
+		    /* hot trace: go on parsing the node the jmp led to */
+		    TraceJmp = 0;
+		    if (j_t == TraceTarget && !(EFLAGS & TF)) {
+			if (debug_level('e')>1)
+			    e_printf("JMP %08x: joined trace at %08x\n",P2,j_t);
+			InvalidateNodeRange(j_t, 1, NULL, INV_CODE);
+			TracesBuilt++;
+			TheCPU.mode |= SKIPOP;
+			TheCPU.eip = d_t;
+			return j_t;
+		    }
+		}
 #endif
 		if (dsp < 0) mode |= CKSIGN;
 		if (CONFIG_CPUSIM)
@@ -403,7 +423,8 @@ static unsigned int FindExecCode(unsigned int PC)
 	while (!(CEmuStat & (CeS_TRAP|CeS_DRTRAP|CeS_SIGPEND)) &&
 	       (G=FindTree(PC))) {
 		if (!GoodNode(G, mode)) {
-			InvalidateNodeRange(G->seqbase, G->seqlen, NULL);
+			InvalidateNodeRange(G->seqbase, G->seqlen, NULL,
+					    INV_CODE);
 			return PC;
 		}
 		if (debug_level('e')>2)
@@ -426,6 +447,10 @@ static unsigned int FindExecCode(unsigned int PC)
 			if (j != -1)
 				error("@corrupted at %x\n", G->seqbase + j);
 		}
+		/* a hot node can be dropped here to be parsed again
+		 * together with its successor */
+		if (G->execs == HOT_TRACE && HotTrace(G))
+			return PC;
 		/* ---- this is the MAIN EXECUTE point ---- */
 		NodesExecd++;
 #if PROFILE
@@ -489,6 +514,74 @@ static unsigned int _Interp86(unsigned int PC, int mod0);
 static unsigned int InterpOne(unsigned int PC, int *_basemode, int *__mode,
 		int *_NewNode);
 
+#ifdef HOST_ARCH_X86
+/*
+ * Translating a block costs far more than interpreting it once, and
+ * much code (setup, loaders, menus) runs only a few times. So the
+ * first COLD_RUNS times a block without translation is reached it is
+ * run by the sim backend, up to its final jump, and it is translated
+ * only when it is reached again. The counts are kept in a small hash
+ * table; a collision only makes a block warm up earlier or later.
+ */
+#define COLD_HASH_MASK	0xfff
+static struct {
+	unsigned int pc, runs;
+} ColdTab[COLD_HASH_MASK+1];
+static int ColdRun;
+
+static int ColdBlock(unsigned int PC)
+{
+	unsigned int h = (PC ^ (PC >> 12)) & COLD_HASH_MASK;
+
+	if (ColdTab[h].pc != PC) {
+		ColdTab[h].pc = PC;
+		ColdTab[h].runs = 0;
+	}
+	if (ColdTab[h].runs >= COLD_RUNS)
+		return 0;
+	ColdTab[h].runs++;
+	return 1;
+}
+
+/*
+ * Under the JIT the guest FPU state lives in the host FPU, and the
+ * FPU half of the sim backend is only set up for the env/save ops,
+ * so a cold run stops in front of any FPU instruction.
+ */
+static int cold_fpu(unsigned int PC)
+{
+	int n;
+
+	for (n = 0; n < 15; n++) {
+		switch (Fetch(PC + n)) {
+		case SEGes: case SEGcs: case SEGss: case SEGds:
+		case SEGfs: case SEGgs: case OPERoverride: case ADDRoverride:
+		case LOCK: case REPNE: case REP:
+			continue;
+		case ESC0: case ESC1: case ESC2: case ESC3:
+		case ESC4: case ESC5: case ESC6: case ESC7:
+			return 1;
+		}
+		break;
+	}
+	return 0;
+}
+
+static void cold_enter(void)
+{
+	InitGen_sim();
+	ColdRun = 1;
+	ColdBlocks++;
+}
+
+static void cold_leave(void)
+{
+	FlagSync_All();
+	InitGen_x86();
+	ColdRun = 0;
+}
+#endif
+
 unsigned int Interp86(unsigned int PC, int mod0)
 {
     unsigned int ret;
@@ -497,6 +590,12 @@ unsigned int Interp86(unsigned int PC, int mod0)
         return 0;
     }
     ret = _Interp86(PC, mod0);
+#ifdef HOST_ARCH_X86
+    if (ColdRun)
+        cold_leave();
+    /* a hot trace retranslation does not survive the exit */
+    TraceJmp = TraceTarget = 0;
+#endif
     TheCPU.eip = ret - LONG_CS;
     return ret;
 }
@@ -518,6 +617,18 @@ static unsigned int interp_pre(unsigned int PC, const int mode, int *_NewNode,
 				CEmuStat |= CeS_TRAP;
 		}
 #ifdef HOST_ARCH_X86
+		/* an interpreted cold block ended with its jump, or it
+		 * runs into translated code or an FPU instruction */
+		if (ColdRun && NewNode && (e_querymark(PC, 1) || cold_fpu(PC))) {
+			P0 = PC;
+			CODE_FLUSH2(mode);
+		}
+		if (ColdRun && !NewNode)
+			cold_leave();
+		/* no code here yet, maybe it was translated in an earlier run */
+		if (!CONFIG_CPUSIM && PCacheActive && !NewNode &&
+		    CurrIMeta < 0 && !(EFLAGS & TF) && !e_querymark(PC, 1))
+			pcache_restore(PC, mode);
 		if (!CONFIG_CPUSIM && e_querymark(PC, 1)) {
 			unsigned int P2 = PC;
 			if (NewNode) {
@@ -539,10 +650,14 @@ static unsigned int interp_pre(unsigned int PC, const int mode, int *_NewNode,
 #endif
 			if (P2 == PC || e_querymark(P2, 1)) {
 				/* slow path */
-				InvalidateNodeRange(P2, 1, NULL);
+				InvalidateNodeRange(P2, 1, NULL, INV_CODE);
 			}
 			PC = P2;
 		}
+		if (!CONFIG_CPUSIM && !NewNode && CurrIMeta < 0 &&
+		    !(EFLAGS & TF) && !TraceJmp && !cold_fpu(PC) &&
+		    ColdBlock(PC))
+			cold_enter();
 #if 0
 		/* this obviously can't happen with current code, but
 		 * slows down execution under debug a lot */
@@ -2274,7 +2389,7 @@ repag0:
 					NewIMeta(P0, &rc);
 					CODE_FLUSH();
 					/* don't cache intermediate nodes */
-					InvalidateNodeRange(P0, PC - P0, NULL);
+					InvalidateNodeRange(P0, PC - P0, NULL, INV_CODE);
 				}
 #endif
 				if (CONFIG_CPUSIM) FlagSync_All();
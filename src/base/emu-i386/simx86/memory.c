@@ -35,6 +35,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/mman.h>
@@ -64,6 +65,8 @@ typedef struct _mpmap {
 static tMpMap *MpH = NULL;
 unsigned int mMaxMem = 0;
 int PageFaults = 0;
+int InvalidationsAvoided = 0;
+static int selfmem_fd = -1;
 static tMpMap *LastMp = NULL;
 
 static int e_munprotect(unsigned int addr, size_t len);
@@ -366,6 +369,70 @@ static int e_munprotect(unsigned int addr, size_t len)
 	return ret;
 }
 
+/* change the protection of the pages in a range that we protected,
+ * without touching the page map */
+static int e_protdata(unsigned int addr, size_t len, int prot)
+{
+	unsigned int a, aend = (addr+len-1) & _PAGE_MASK;
+
+	for (a = addr & _PAGE_MASK; a <= aend; a += PAGE_SIZE) {
+	    if (!e_querymprot(a))
+		continue;
+	    if (mprotect_mapping(MAPPING_CPUEMU, a, PAGE_SIZE, prot) < 0) {
+		e_printf("MPDATA: %s\n",strerror(errno));
+		return -1;
+	    }
+	}
+	return 0;
+}
+
+/*
+ * Memory above the aliased low memory has no writable view, so a
+ * write there to a page with code normally invalidates all the code
+ * in the page and unprotects it. If the code bitmap says the write
+ * hits only data, the code can be kept: e_dataonly() tells if that
+ * is the case for a range.
+ */
+int e_dataonly(unsigned int addr, size_t len)
+{
+	if (addr < LOWMEM_SIZE + HMASIZE || len == 0)
+		return 0;
+	if (!e_querymprotrange(addr, len) || e_querymark(addr, len))
+		return 0;
+	if (debug_level('e')>3)
+		e_printf("\tDATA write %08x:%zx in code page\n", addr, len);
+	return 1;
+}
+
+/* Write a few bytes to a range checked with e_dataonly().
+ * /proc/self/mem writes through our write protection, like ptrace
+ * does, which costs much less than the two mprotect() calls, and the
+ * TLB flushes these imply, needed to open the pages otherwise. */
+void e_writedata(unsigned int addr, const void *src, size_t len)
+{
+	if (selfmem_fd != -1 && pwrite(selfmem_fd, src, len,
+			(off_t)(uintptr_t)MEM_BASE32(addr)) == (ssize_t)len) {
+		InvalidationsAvoided++;
+		return;
+	}
+	e_opendata(addr, len);
+	memcpy(MEM_BASE32(addr), src, len);
+	e_closedata(addr, len);
+}
+
+/* Open a range checked with e_dataonly() for a longer write by the
+ * caller, who has to call e_closedata() afterwards */
+void e_opendata(unsigned int addr, size_t len)
+{
+	InvalidationsAvoided++;
+	e_protdata(addr, len, PROT_READ|PROT_WRITE|PROT_EXEC);
+}
+
+void e_closedata(unsigned int addr, size_t len)
+{
+	e_protdata(addr, len, PROT_READ|PROT_EXEC);
+}
+
 #ifdef HOST_ARCH_X86
 int e_handle_pagefault(dosaddr_t addr, unsigned err, sigcontext_t *scp)
 {
@@ -452,9 +519,12 @@ int e_handle_pagefault(dosaddr_t addr, unsigned err, sigcontext_t *scp)
 		return 1;
 #endif
 	/* We HAVE to invalidate all the code in the page
-	 * if the page is going to be unprotected */
+	 * if the page is going to be unprotected.
+	 * A write that hits only data can not be redone here, as we
+	 * don't know the instruction; it is Cpatch above that makes
+	 * such writes from compiled code go through e_writedata(). */
 	addr &= _PAGE_MASK;
-	return InvalidateNodeRange(addr, PAGE_SIZE, p);
+	return InvalidateNodeRange(addr, PAGE_SIZE, p, INV_FAULT);
 }
 
 int e_handle_fault(sigcontext_t *scp)
@@ -483,6 +553,9 @@ void mprot_init(void)
 	MpH = NULL;
 	AddMpMap(0,0,0);	/* first mega in first entry */
 	PageFaults = 0;
+	InvalidationsAvoided = 0;
+	if (selfmem_fd == -1)
+		selfmem_fd = open("/proc/self/mem", O_RDWR | O_CLOEXEC);
 }
 
 void mprot_end(void)
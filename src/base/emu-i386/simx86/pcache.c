@@ -0,0 +1,518 @@
+/*
+ *  (C) Copyright 1992, ..., 2014 the "DOSEMU-Development-Team".
+ *
+ *  for details see file COPYING in the DOSEMU distribution
+ *
+ *  Persistent on-disk cache of translated code sequences.
+ *
+ * The code produced by ProduceCode() only refers to the emulated CPU
+ * through ebx and to guest memory through ebp, and its inter-node link
+ * sites are kept as offsets from the code start. A translated sequence
+ * is thus a pure function of the guest bytes it was parsed from, of its
+ * linear address, CS base and CPU mode, and of the dosemu binary that
+ * generated it. We store such sequences in a file, keyed by address, CS
+ * and mode plus a hash of the guest bytes, and hand them back to the
+ * node directory on a later run instead of parsing the code again.
+ *
+ * The file starts with a header identifying the binary (by its ELF build
+ * id) and is followed by self-checking records. It is mapped read-only
+ * at startup; new sequences are collected in memory and appended under
+ * flock() when the emulator is left, so that any number of dosemu
+ * instances can share one cache file. A file that belongs to another
+ * binary or grew beyond PCACHE_MAXSIZE is replaced by rename(), which
+ * leaves the mappings of running instances intact.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <link.h>
+#include <elf.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#undef DT_FLAGS		/* elf.h, clashes with emu-ldt.h */
+#include "emu86.h"
+#include "dlmalloc.h"
+#include "codegen-arch.h"
+#include "emudpmi.h"
+#include "pcache.h"
+
+#define PCACHE_MAGIC	"DOSEMUJC"
+#define PCACHE_VERSION	2
+#define PCACHE_MAXSIZE	(64 << 20)
+/* extra guest bytes hashed past the end of a sequence: the last
+ * instruction can extend past seqbase+seqlen, and the parser peeks at
+ * the instruction following a conditional jump */
+#define PCACHE_TAIL	16
+#define BUILD_ID_MAX	32
+
+/* pc_header.flags: options that change the generated code */
+#define PCF_FASTFPU	1
+
+struct pc_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t cpu_type;
+	uint32_t flags;
+	uint32_t idlen;
+	uint8_t id[BUILD_ID_MAX];
+};
+
+struct pc_rec {
+	uint32_t size;		/* whole record, multiple of 8 */
+	uint32_t csum;		/* of everything after this field */
+	uint32_t key, cs, mode, seqbase;
+	uint16_t seqlen, seqnum, flags, len;
+	uint32_t hlen;		/* guest bytes covered by ghash */
+	int32_t t_rel, nt_rel;	/* link sites from code start, -1=none */
+	uint8_t t_type, pad[7];
+	uint64_t ghash;
+	Addr2Pc meta[0];	/* seqnum+1 of these, followed by the code */
+};
+
+int PCacheActive = 0;
+int PCacheRestored = 0;
+int PCacheStored = 0;
+
+static struct pc_header pc_hdr;
+static void *pc_map;
+static size_t pc_map_size;
+
+/* open-addressed index of all records, mapped and new */
+static struct pc_rec **pc_index;
+static unsigned int pc_index_size, pc_index_count;
+
+/* records created in this session, written out by pcache_end() */
+static struct pc_rec **pc_new;
+static int pc_new_count, pc_new_size;
+static size_t pc_new_bytes;
+
+/////////////////////////////////////////////////////////////////////////////
+
+static uint32_t fnv32(const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	uint32_t h = 2166136261u;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static uint64_t fnv64(const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	uint64_t h = 14695981039346656037ull;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+static uint32_t rec_csum(const struct pc_rec *R)
+{
+	return fnv32(&R->key, R->size - offsetof(struct pc_rec, key));
+}
+
+/* only hash guest memory we can safely read from here */
+static int guest_range_ok(unsigned int addr, unsigned int len)
+{
+	if (addr + len < addr)
+		return 0;
+	if (addr + len <= 0x110000)
+		return 1;
+	return dpmi_is_valid_range(addr, len);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static int find_build_id(struct dl_phdr_info *info, size_t size, void *data)
+{
+	struct pc_header *h = data;
+	uintptr_t self = (uintptr_t)pcache_init;
+	int i, found = 0;
+
+	for (i = 0; i < info->dlpi_phnum; i++) {
+		const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+		uintptr_t start = info->dlpi_addr + ph->p_vaddr;
+		if (ph->p_type == PT_LOAD && self >= start &&
+				self < start + ph->p_memsz)
+			found = 1;
+	}
+	if (!found)
+		return 0;
+	for (i = 0; i < info->dlpi_phnum; i++) {
+		const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+		const char *p, *end;
+
+		if (ph->p_type != PT_NOTE)
+			continue;
+		p = (const char *)(info->dlpi_addr + ph->p_vaddr);
+		end = p + ph->p_memsz;
+		while (p + sizeof(ElfW(Nhdr)) <= end) {
+			const ElfW(Nhdr) *n = (const ElfW(Nhdr) *)p;
+			const char *name = p + sizeof(*n);
+			const char *desc = name + ((n->n_namesz + 3) & ~3);
+
+			if (n->n_type == NT_GNU_BUILD_ID && n->n_namesz == 4 &&
+					memcmp(name, "GNU", 4) == 0) {
+				h->idlen = n->n_descsz < BUILD_ID_MAX ?
+					n->n_descsz : BUILD_ID_MAX;
+				memcpy(h->id, desc, h->idlen);
+				return 1;
+			}
+			p = desc + ((n->n_descsz + 3) & ~3);
+		}
+	}
+	return 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned int pc_slot(unsigned int key, unsigned int cs,
+	unsigned int mode)
+{
+	return ((key * 0x9e3779b1u) ^ (cs * 0x85ebca6bu) ^ mode) &
+		(pc_index_size - 1);
+}
+
+static void pc_index_add(struct pc_rec *R)
+{
+	unsigned int i;
+
+	if (2 * (pc_index_count + 1) > pc_index_size) {
+		struct pc_rec **old = pc_index;
+		unsigned int j, osize = pc_index_size;
+
+		pc_index_size = osize ? osize * 2 : 1024;
+		pc_index = calloc(pc_index_size, sizeof(*pc_index));
+		for (j = 0; j < osize; j++) {
+			struct pc_rec *O = old[j];
+			if (!O)
+				continue;
+			i = pc_slot(O->key, O->cs, O->mode);
+			while (pc_index[i])
+				i = (i + 1) & (pc_index_size - 1);
+			pc_index[i] = O;
+		}
+		free(old);
+	}
+	i = pc_slot(R->key, R->cs, R->mode);
+	while (pc_index[i])
+		i = (i + 1) & (pc_index_size - 1);
+	pc_index[i] = R;
+	pc_index_count++;
+}
+
+/* find a record for the sequence at key whose guest bytes still match */
+static struct pc_rec *pc_index_find(unsigned int key, unsigned int cs,
+	unsigned int mode)
+{
+	unsigned int i;
+	struct pc_rec *R;
+
+	if (!pc_index_count)
+		return NULL;
+	for (i = pc_slot(key, cs, mode); (R = pc_index[i]);
+			i = (i + 1) & (pc_index_size - 1)) {
+		if (R->key != key || R->cs != cs || R->mode != mode)
+			continue;
+		if (!guest_range_ok(R->seqbase, R->hlen))
+			continue;
+		if (fnv64(MEM_BASE32(R->seqbase), R->hlen) == R->ghash)
+			return R;
+	}
+	return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void pcache_load(const char *path)
+{
+	int fd;
+	struct stat st;
+	const struct pc_header *h;
+	size_t off;
+	int n = 0;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return;
+	if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(*h)) {
+		close(fd);
+		return;
+	}
+	pc_map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (pc_map == MAP_FAILED) {
+		pc_map = NULL;
+		return;
+	}
+	pc_map_size = st.st_size;
+	h = pc_map;
+	if (memcmp(h, &pc_hdr, sizeof(*h)) != 0) {
+		e_printf("PCACHE: %s is from another build or setup, ignored\n", path);
+		return;
+	}
+	/* a record can only be partly there if a write failed */
+	for (off = sizeof(*h); off + sizeof(struct pc_rec) <= pc_map_size;) {
+		struct pc_rec *R = (struct pc_rec *)((char *)pc_map + off);
+
+		if (R->size < sizeof(*R) || (R->size & 7) ||
+				R->size > pc_map_size - off ||
+				offsetof(struct pc_rec, meta) +
+				(R->seqnum + 1) * sizeof(Addr2Pc) + R->len >
+				R->size || rec_csum(R) != R->csum)
+			break;
+		pc_index_add(R);
+		off += R->size;
+		n++;
+	}
+	e_printf("PCACHE: %d sequences loaded from %s\n", n, path);
+}
+
+void pcache_init(void)
+{
+	if (PCacheActive || !config.cpuemu_cache || !config.cpuemu_cache[0])
+		return;
+	memset(&pc_hdr, 0, sizeof(pc_hdr));
+	memcpy(pc_hdr.magic, PCACHE_MAGIC, sizeof(pc_hdr.magic));
+	pc_hdr.version = PCACHE_VERSION;
+	pc_hdr.cpu_type = vm86s.cpu_type;
+	if (config.cpuemu_fastfpu)
+		pc_hdr.flags |= PCF_FASTFPU;
+	dl_iterate_phdr(find_build_id, &pc_hdr);
+	if (!pc_hdr.idlen) {
+		error("CPUEMU: no build id, translation cache disabled\n");
+		return;
+	}
+	PCacheActive = 1;
+	PCacheRestored = PCacheStored = 0;
+	pcache_load(config.cpuemu_cache);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static int write_recs(int fd)
+{
+	int i;
+
+	for (i = 0; i < pc_new_count; i++) {
+		if (write(fd, pc_new[i], pc_new[i]->size) != pc_new[i]->size)
+			return -1;
+	}
+	return 0;
+}
+
+/* replace the cache file with a fresh one holding only our records */
+static void pcache_rewrite(const char *path)
+{
+	char *tmp;
+	int fd;
+
+	if (asprintf(&tmp, "%s.XXXXXX", path) == -1)
+		return;
+	fd = mkstemp(tmp);
+	if (fd == -1) {
+		error("CPUEMU: cannot create %s: %s\n", tmp, strerror(errno));
+		free(tmp);
+		return;
+	}
+	if (fchmod(fd, 0644) == -1 ||
+			write(fd, &pc_hdr, sizeof(pc_hdr)) != sizeof(pc_hdr) ||
+			write_recs(fd) == -1 || rename(tmp, path) == -1) {
+		error("CPUEMU: cannot write %s: %s\n", path, strerror(errno));
+		unlink(tmp);
+	}
+	close(fd);
+	free(tmp);
+}
+
+static void pcache_write(const char *path)
+{
+	int fd;
+	struct stat st;
+	struct pc_header h;
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		error("CPUEMU: cannot open %s: %s\n", path, strerror(errno));
+		return;
+	}
+	flock(fd, LOCK_EX);
+	if (fstat(fd, &st) == -1)
+		goto out;
+	if (st.st_size == 0) {
+		/* nobody can have an empty file mapped */
+		if (write(fd, &pc_hdr, sizeof(pc_hdr)) != sizeof(pc_hdr) ||
+				write_recs(fd) == -1)
+			goto fail;
+	} else if (st.st_size < (off_t)sizeof(h) ||
+			pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+			memcmp(&h, &pc_hdr, sizeof(h)) != 0 ||
+			st.st_size + pc_new_bytes > PCACHE_MAXSIZE) {
+		pcache_rewrite(path);
+	} else {
+		if (lseek(fd, 0, SEEK_END) == -1 || write_recs(fd) == -1)
+			goto fail;
+	}
+	goto out;
+
+fail:
+	error("CPUEMU: cannot write %s: %s\n", path, strerror(errno));
+	/* do not leave a partial record behind */
+	if (ftruncate(fd, st.st_size) == -1)
+		error("CPUEMU: %s may be damaged\n", path);
+out:
+	flock(fd, LOCK_UN);
+	close(fd);
+}
+
+void pcache_end(void)
+{
+	int i;
+
+	if (!PCacheActive)
+		return;
+	e_printf("PCACHE: %d sequences restored, %d stored\n",
+		 PCacheRestored, PCacheStored);
+	if (pc_new_count)
+		pcache_write(config.cpuemu_cache);
+	for (i = 0; i < pc_new_count; i++)
+		free(pc_new[i]);
+	free(pc_new);
+	pc_new = NULL;
+	pc_new_count = pc_new_size = 0;
+	pc_new_bytes = 0;
+	free(pc_index);
+	pc_index = NULL;
+	pc_index_size = pc_index_count = 0;
+	if (pc_map)
+		munmap(pc_map, pc_map_size);
+	pc_map = NULL;
+	PCacheActive = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+/*
+ * Save a freshly translated node. This has to be done before the node
+ * is linked or patched, i.e. before it is executed for the first time.
+ */
+void pcache_store(TNode *G)
+{
+	struct pc_rec *R;
+	size_t msize, size;
+	unsigned int hlen = G->seqlen + PCACHE_TAIL;
+
+	if (!PCacheActive || (EFLAGS & TF))
+		return;
+	if (!guest_range_ok(G->seqbase, hlen))
+		return;
+	if (pc_index_find(G->key, G->cs, G->mode))
+		return;
+	msize = (G->seqnum + 1) * sizeof(Addr2Pc);
+	size = (offsetof(struct pc_rec, meta) + msize + G->len + 7) & ~7;
+	if (pc_new_bytes + size > PCACHE_MAXSIZE)
+		return;
+	R = calloc(1, size);
+	if (!R)
+		return;
+	R->size = size;
+	R->key = G->key;
+	R->cs = G->cs;
+	R->mode = G->mode;
+	R->seqbase = G->seqbase;
+	R->seqlen = G->seqlen;
+	R->seqnum = G->seqnum;
+	R->flags = G->flags;
+	R->len = G->len;
+	R->hlen = hlen;
+	R->ghash = fnv64(MEM_BASE32(G->seqbase), hlen);
+	R->t_type = G->clink.t_type;
+	R->t_rel = G->clink.t_link.abs ?
+		(unsigned char *)G->clink.t_link.abs - G->addr : -1;
+	R->nt_rel = G->clink.nt_link.abs ?
+		(unsigned char *)G->clink.nt_link.abs - G->addr : -1;
+	memcpy(R->meta, G->pmeta, msize);
+	memcpy((char *)R->meta + msize, G->addr, G->len);
+	R->csum = rec_csum(R);
+
+	if (pc_new_count == pc_new_size) {
+		pc_new_size = pc_new_size ? pc_new_size * 2 : 256;
+		pc_new = realloc(pc_new, pc_new_size * sizeof(*pc_new));
+	}
+	pc_new[pc_new_count++] = R;
+	pc_new_bytes += size;
+	pc_index_add(R);
+	PCacheStored++;
+}
+
+/*
+ * Look for a cached translation of the code at PC and, if the guest
+ * bytes still match, move it into the node directory exactly as
+ * CloseAndExec_x86() does for a newly compiled sequence.
+ */
+TNode *pcache_restore(unsigned int PC, int mode)
+{
+	struct pc_rec *R;
+	IMeta *I0 = &InstrMeta[0];
+	CodeBuf *GenCodeBuf;
+	TNode *G;
+	size_t msize;
+	int i;
+
+	R = pc_index_find(PC, LONG_CS, mode);
+	if (!R)
+		return NULL;
+	if (e_querymark(R->seqbase, R->seqlen))
+		InvalidateNodeRange(R->seqbase, R->seqlen, NULL, INV_CODE);
+
+	msize = (R->seqnum + 1) * sizeof(Addr2Pc);
+	GenCodeBuf = dlmalloc(offsetof(CodeBuf, meta) + msize + R->len);
+	memcpy(GenCodeBuf->meta, R->meta, msize);
+	memcpy((char *)GenCodeBuf->meta + msize, (char *)R->meta + msize,
+	       R->len);
+
+	/* rebuild what Move2Tree() wants from the InstrMeta array */
+	for (i = 0; i < R->seqnum; i++) {
+		IMeta *I = &InstrMeta[i];
+		I->npc = R->key + R->meta[i].dnpc;
+		I->daddr = R->meta[i].daddr;
+		I->len = R->meta[i+1].daddr - R->meta[i].daddr;
+	}
+	I0->seqbase = R->seqbase;
+	I0->seqlen = R->seqlen;
+	I0->ncount = R->seqnum;
+	I0->totlen = R->len;
+	I0->flags = R->flags;
+	memset(&I0->clink, 0, sizeof(I0->clink));
+	I0->clink.t_type = R->t_type;
+	if (R->t_type >= JMP_LINK)
+		I0->clink.t_link.rel = R->t_rel;
+	else if (R->t_rel >= 0)
+		I0->clink.t_link.abs = (unsigned int *)
+			((char *)GenCodeBuf->meta + msize + R->t_rel);
+	if (R->t_type > JMP_LINK)
+		I0->clink.nt_link.rel = R->nt_rel;
+	else if (R->nt_rel >= 0)
+		I0->clink.nt_link.abs = (unsigned int *)
+			((char *)GenCodeBuf->meta + msize + R->nt_rel);
+
+	G = Move2Tree(I0, GenCodeBuf);
+	e_markpage(G->seqbase, G->seqlen);
+	e_mprotect(G->seqbase, G->seqlen);
+	G->cs = LONG_CS;
+	G->mode = mode;
+	PCacheRestored++;
+	if (debug_level('e')>2)
+		e_printf("PCACHE: restored sequence at %08x\n", PC);
+	return G;
+}
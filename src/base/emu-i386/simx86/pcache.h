@@ -0,0 +1,23 @@
+/*
+ *  (C) Copyright 1992, ..., 2014 the "DOSEMU-Development-Team".
+ *
+ *  for details see file COPYING in the DOSEMU distribution
+ *
+ *  Persistent on-disk cache of translated code sequences.
+ */
+
+#ifndef _EMU86_PCACHE_H
+#define _EMU86_PCACHE_H
+
+#include "trees.h"
+
+extern int PCacheActive;
+extern int PCacheRestored;
+extern int PCacheStored;
+
+void pcache_init(void);
+void pcache_end(void);
+void pcache_store(TNode *G);
+TNode *pcache_restore(unsigned int PC, int mode);
+
+#endif
@@ -30,13 +30,6 @@
  *  (linux/arch/i386/kernel/vm86.c). This code originally was written by
  *  Linus Torvalds with later enhancements by Lutz Molgedey and Hans Lermen.
  *
- * 2. The tree handling routines were adapted from libavl:
- *  libavl - manipulates AVL trees.
- *  Copyright (C) 1998, 1999 Free Software Foundation, Inc.
- *  The author may be contacted at <pfaffben@pilot.msu.edu> on the
- *  Internet, or as Ben Pfaff, 12167 Airport Rd, DeWitt MI 48820, USA
- *  through more mundane means.
- *
  ***************************************************************************/
 
 #include <stddef.h>
@@ -49,13 +42,14 @@
 #include "emu86.h"
 #include "dlmalloc.h"
 #include "codegen-arch.h"
+#include "pcache.h"
 
 IMeta	*InstrMeta;
 int	CurrIMeta = -1;
 
-/* Tree structure to store collected code sequences */
-avltr_tree CollectTree;
-avltr_traverser Traverser;
+/* Node list and block directory to store collected code sequences */
+static TNode NodeList;
+static TNode *Traverser;
 int ninodes = 0;
 
 int NodesCleaned = 0;
@@ -63,9 +57,24 @@ int NodesParsed = 0;
 int NodesExecd = 0;
 int CleanFreq = 8;
 int CreationIndex = 0;
+int NodeEntries = 0;
+int NodeLinks = 0;
+int TracesBuilt = 0;
+int ColdBlocks = 0;
+
+/* code cache statistics, see e_cache_stats() */
+unsigned long CodeCacheBytes = 0;
+int CodeCacheHits = 0;
+int CodeCacheMisses = 0;
+int CodeCacheEvictions = 0;
+int NodesInvalidated[INV_CAUSES];
+
+/* jmp to be swallowed by the node being retranslated, see HotTrace() */
+unsigned int TraceJmp = 0;
+unsigned int TraceTarget = 0;
 
 #if PROFILE
-int MaxDepth = 0;
+unsigned int MaxPageNodes = 0;
 int MaxNodes = 0;
 int MaxNodeSize = 0;
 int TotalNodesParsed = 0;
@@ -90,312 +99,183 @@ int NodeLimit = 10000;
 	((_a2 >= (l)) && (_a2 < (h))); })
 
 /////////////////////////////////////////////////////////////////////////////
+/*
+ * The block directory.
+ *
+ * Translated sequences are indexed by the 4k page(s) their source code
+ * covers, with a two-level directory in front of the pages so that the
+ * whole 32-bit linear space can be addressed without a flat 1M entry
+ * table. Every page keeps the nodes touching it in an array sorted by
+ * key; a node spanning a page boundary is stored in all of its pages.
+ * Finding a key is a direct lookup of its page followed by a binary
+ * search over the (few) nodes on that page, and invalidating a range
+ * only has to look at the nodes of the pages involved.
+ */
 
-#define NEXTNODE(g)	({__typeof__(g) _g = (g)->link[1]; \
-			  if ((g)->rtag == PLUS) \
-			    while (_g->link[0]!=NULL) _g=_g->link[0]; \
-			  _g; })
+#define TDIR_L2_BITS	10
+#define TDIR_L1_BITS	(32 - PAGE_SHIFT - TDIR_L2_BITS)
+#define TDIR_L1(p)	((p) >> TDIR_L2_BITS)
+#define TDIR_L2(p)	((p) & ((1 << TDIR_L2_BITS) - 1))
 
-static inline TNode *Tmalloc(void)
+typedef struct {
+	TNode **nodes;
+	unsigned int count, size;
+} tpage;
+
+static tpage *tdir[1 << TDIR_L1_BITS];
+
+static inline tpage *tdir_page(unsigned int page, int create)
 {
-  TNode *G  = TNodePool->link[0];
-  TNode *G1 = G->link[0];
-  if (G1==TNodePool) leavedos_main(0x4c4c); // return NULL;
-  TNodePool->link[0] = G1; G->link[0]=NULL;
-  memset(G, 0, sizeof(TNode));	// "bug covering"
-  return G;
+  tpage *T = tdir[TDIR_L1(page)];
+
+  if (T == NULL) {
+	if (!create) return NULL;
+	T = calloc(1 << TDIR_L2_BITS, sizeof(tpage));
+	if (T == NULL) leavedos_main(0x8202);
+	tdir[TDIR_L1(page)] = T;
+  }
+  return &T[TDIR_L2(page)];
 }
 
-static inline void Tfree(TNode *G)
+/* first index in P with a key not less than key */
+static inline int tpage_search(tpage *P, int key)
 {
-  G->key = G->alive = 0;
-  G->addr = NULL;
-  G->link[0] = TNodePool->link[0];
-  TNodePool->link[0] = G;
-}
+  int lo = 0, hi = P->count;
 
-/////////////////////////////////////////////////////////////////////////////
+  while (lo < hi) {
+      int mid = (lo + hi) >> 1;
+      if (P->nodes[mid]->key < key) lo = mid + 1;
+	else hi = mid;
+  }
+  return lo;
+}
 
-static inline void datacopy(TNode *nd, TNode *ns)
+/* first and last page touched by the source code of a node */
+static inline void tnode_pages(TNode *G, unsigned int *p0, unsigned int *p1)
 {
-  char *s = (char *)&(ns->key);
-  char *d = (char *)&(nd->key);
-  int l = sizeof(TNode)-offsetof(TNode,key);
-  memcpy(d,s,l);
+  unsigned int lo = G->seqbase, hi = G->seqbase + G->seqlen;
+
+  if ((unsigned int)G->key < lo) lo = G->key;
+  if ((unsigned int)G->key > hi) hi = G->key;
+  *p0 = lo >> PAGE_SHIFT;
+  *p1 = hi >> PAGE_SHIFT;
 }
 
-static TNode *avltr_probe (const int key, int *found)
+static void tdir_insert(TNode *G)
 {
-  avltr_tree *tree = &CollectTree;
-  TNode *t;
-  TNode *s, *p, *q, *r;
-  int k = 1;
-
-  t = &tree->root;
-  s = p = t->link[0];
-
-  if (s == NULL) {
-      tree->count++;
-      ninodes = tree->count;
-      q = t->link[0] = Tmalloc();
-      q->link[0] = NULL;
-      q->link[1] = t;
-      q->rtag = MINUS;
-      q->bal = 0;
-      return q;
-  }
-
-  for (;;) {
-      int diff = (key - p->key);
-
-      if (diff < 0) {
-	  p->cache = 0;
-	  q = p->link[0];
-	  if (q == NULL) {
-	      q = Tmalloc();
-	      p->link[0] = q;
-	      q->link[0] = NULL;
-	      q->link[1] = p;
-	      q->rtag = MINUS;
-	      break;
-	  }
-      }
-      else if (diff > 0) {
-	  p->cache = 1;
-	  q = p->link[1];
-	  if (p->rtag == MINUS) {
-	      q = Tmalloc();
-	      q->link[1] = p->link[1];
-	      q->rtag = p->rtag;
-	      p->link[1] = q;
-	      p->rtag = PLUS;
-	      q->link[0] = NULL;
-	      break;
-	  }
-      }
-      else {	/* found */
-        *found = 1;
-	return p;
-      }
+  unsigned int page, p1;
 
-      if (q->bal != 0) t = p, s = q;
-      p = q;
-      k++;
-/**/ if (k>=AVL_MAX_HEIGHT) leavedos_main(0x777);
-#if PROFILE
-      if (debug_level('e')) if (k>MaxDepth) MaxDepth=k;
-#endif
-  }
+  tnode_pages(G, &page, &p1);
+  do {
+      tpage *P = tdir_page(page, 1);
+      int i = tpage_search(P, G->key);
 
-  tree->count++;
-  ninodes = tree->count;
+      if (P->count == P->size) {
+	  P->size = P->size ? P->size * 2 : 4;
+	  P->nodes = realloc(P->nodes, P->size * sizeof(TNode *));
+	  if (P->nodes == NULL) leavedos_main(0x8203);
+      }
+      memmove(&P->nodes[i+1], &P->nodes[i],
+	      (P->count - i) * sizeof(TNode *));
+      P->nodes[i] = G;
+      P->count++;
 #if PROFILE
-  if (debug_level('e')) if (ninodes > MaxNodes) MaxNodes = ninodes;
+      if (debug_level('e')) if (P->count > MaxPageNodes) MaxPageNodes = P->count;
 #endif
-  q->bal = 0;
-
-  r = p = s->link[(int) s->cache];
-  while (p != q) {
-      p->bal = p->cache * 2 - 1;
-      p = p->link[(int) p->cache];
-  }
+  } while (page++ != p1);
+}
 
-  if (s->cache == 0) {
-      if (s->bal == 0) {
-	  s->bal = -1;
-	  return q;
-      }
-      else if (s->bal == +1) {
-	  s->bal = 0;
-	  return q;
+static void tdir_remove(TNode *G)
+{
+  unsigned int page, p1;
+
+  tnode_pages(G, &page, &p1);
+  do {
+      tpage *P = tdir_page(page, 0);
+      int i;
+
+      if (P == NULL) leavedos_main(0x8204);
+      i = tpage_search(P, G->key);
+      if (i >= P->count || P->nodes[i] != G) leavedos_main(0x8204);
+      P->count--;
+      memmove(&P->nodes[i], &P->nodes[i+1],
+	      (P->count - i) * sizeof(TNode *));
+      if (P->count == 0) {
+	  free(P->nodes);
+	  P->nodes = NULL;
+	  P->size = 0;
       }
+  } while (page++ != p1);
+}
 
-      if (r->bal == -1)	{
-	  p = r;
-	  if (r->rtag == MINUS) {
-	      s->link[0] = NULL;
-	      r->link[1] = s;
-	      r->rtag = PLUS;
-	  }
-	  else {
-	      s->link[0] = r->link[1];
-	      r->link[1] = s;
-	  }
-	  s->bal = r->bal = 0;
-      }
-      else {
-	  p = r->link[1];
-	  r->link[1] = p->link[0];
-	  p->link[0] = r;
-	  s->link[0] = p->link[1];
-	  p->link[1] = s;
-	  if (p->bal == -1) s->bal = 1, r->bal = 0;
-	    else if (p->bal == 0) s->bal = r->bal = 0;
-	      else s->bal = 0, r->bal = -1;
-	  p->bal = 0;
-	  p->rtag = PLUS;
-	  if (s->link[0] == s) s->link[0] = NULL;
-	  if (r->link[1] == NULL) {
-	      r->link[1] = p;
-	      r->rtag = MINUS;
-	  }
-      }
-  }
-  else {
-      if (s->bal == 0) {
-	  s->bal = 1;
-	  return q;
-      }
-      else if (s->bal == -1) {
-	  s->bal = 0;
-	  return q;
-      }
+static TNode *tdir_find(int key)
+{
+  tpage *P = tdir_page((unsigned int)key >> PAGE_SHIFT, 0);
+  int i;
 
-      if (r->bal == +1)	{
-	  p = r;
-	  if (r->link[0] == NULL) {
-	      s->rtag = MINUS;
-	      r->link[0] = s;
-	  }
-	  else {
-	      s->link[1] = r->link[0];
-	      s->rtag = PLUS;
-	      r->link[0] = s;
-	  }
-	  s->bal = r->bal = 0;
-      }
-      else {
-	  p = r->link[0];
-	  r->link[0] = p->link[1];
-	  p->link[1] = r;
-	  s->link[1] = p->link[0];
-	  p->link[0] = s;
-	  if (p->bal == +1) s->bal = -1, r->bal = 0;
-	    else if (p->bal == 0) s->bal = r->bal = 0;
-	      else s->bal = 0, r->bal = 1;
-	  p->rtag = PLUS;
-	  if (s->link[1] == NULL) {
-	      s->link[1] = p;
-	      s->rtag = MINUS;
-	  }
-	  if (r->link[0] == r) r->link[0] = NULL;
-	  p->bal = 0;
-      }
-  }
+  if (P == NULL || P->count == 0) return NULL;
+  i = tpage_search(P, key);
+  if (i < P->count && P->nodes[i]->key == key) return P->nodes[i];
+  return NULL;
+}
 
-  if (t != &tree->root && s == t->link[1]) t->link[1] = p;
-    else t->link[0] = p;
+/////////////////////////////////////////////////////////////////////////////
+/*
+ * All nodes are also kept in a circular list; it is walked by the
+ * cleaner (TraverseAndClean), which ages and deletes nodes one by one.
+ */
 
-  return q;
+static inline void list_del(TNode *G)
+{
+  G->prev->next = G->next;
+  G->next->prev = G->prev;
 }
 
+static inline void list_add(TNode *G, TNode *after)
+{
+  G->prev = after;
+  G->next = after->next;
+  after->next->prev = G;
+  after->next = G;
+}
 
-void avltr_delete (const int key)
+static inline TNode *Tmalloc(void)
 {
-  avltr_tree *tree = &CollectTree;
-  TNode *pa[AVL_MAX_HEIGHT];		/* Stack P: Nodes. */
-  unsigned char a[AVL_MAX_HEIGHT];	/* Stack P: Bits. */
-  int k = 1;				/* Stack P: Pointer. */
-  TNode *p;
-
-  a[0] = 0;
-  pa[0] = &tree->root;
-  p = tree->root.link[0];
-  if (p == NULL) return;
+  TNode *G  = TNodePool->next;
+  TNode *G1 = G->next;
+  if (G1==TNodePool) leavedos_main(0x4c4c); // return NULL;
+  TNodePool->next = G1;
+  memset(G, 0, sizeof(TNode));	// "bug covering"
+  return G;
+}
 
-  for (;;) {
-      int diff = (key - p->key);
+static inline void Tfree(TNode *G)
+{
+  G->key = G->alive = 0;
+  G->addr = NULL;
+  G->prev = NULL;
+  G->next = TNodePool->next;
+  TNodePool->next = G;
+}
 
-      if (diff==0) break;
-      pa[k] = p;
-      if (diff < 0) {
-	  if (p->link[0] == NULL) return;
-	  p = p->link[0]; a[k] = 0;
-      }
-      else if (diff > 0) {
-	  if (p->rtag != PLUS) return;
-	  p = p->link[1]; a[k] = 1;
-      }
-      k++;
-/**/ if (k>=AVL_MAX_HEIGHT) leavedos_main(0x777);
-  }
+/////////////////////////////////////////////////////////////////////////////
+
+void tdir_delete (const int key)
+{
+  TNode *p = tdir_find(key);
+
+  if (p == NULL) return;
 #if !defined(SINGLESTEP)&&!defined(SINGLEBLOCK)
   if (debug_level('e')>2)
 	e_printf("Found node to delete at %p(%08x)\n",p,p->key);
 #endif
-  tree->count--;
-  ninodes = tree->count;
-
-  {
-    TNode *t = p;
-    TNode **q = &pa[k - 1]->link[(int) a[k - 1]];
-
-    if (t->rtag == MINUS) {
-	if (t->link[0] != NULL) {
-	    TNode *const x = t->link[0];
-
-	    *q = x;
-	    (*q)->bal = 0;
-	    if (x->rtag == MINUS) {
-		if (a[k - 1] == 1) x->link[1] = t->link[1];
-		  else x->link[1] = pa[k - 1];
-	    }
-	}
-	else {
-	    *q = t->link[a[k - 1]];
-	    if (a[k - 1] == 0) pa[k - 1]->link[0] = NULL;
-	      else pa[k - 1]->rtag = MINUS;
-	}
-    }
-    else {
-	TNode *r = t->link[1];
-	if (r->link[0] == NULL) {
-	    r->link[0] = t->link[0];
-	    r->bal = t->bal;
-	    if (r->link[0] != NULL) {
-		TNode *s = r->link[0];
-		while (s->rtag == PLUS) s = s->link[1];
-		s->link[1] = r;
-	    }
-	    *q = r;
-	    a[k] = 1;
-	    pa[k++] = r;
-	}
-	else {
-	    TNode *s = r->link[0];
-
-	    a[k] = 1;
-	    pa[k++] = t;
-
-	    a[k] = 0;
-	    pa[k++] = r;
+  tdir_remove(p);
+  if (Traverser == p) Traverser = p->prev;
+  list_del(p);
+  if (findtree_cache[key&FINDTREE_CACHE_HASH_MASK] == p)
+	findtree_cache[key&FINDTREE_CACHE_HASH_MASK] = NULL;
+  ninodes--;
 
-	    while (s->link[0] != NULL) {
-		r = s;
-		s = r->link[0];
-		a[k] = 0;
-		pa[k++] = r;
-	    }
-
-	    if (t->mblock) dlfree(t->mblock);
-/* e_printf("<03 node exchange %p->%p>\n",s,t); */
-	    datacopy(t, s);
-/**/	    if (t->addr==NULL) leavedos_main(0x8130);
-	    /* keep the node reference to itself */
-	    t->mblock->bkptr = t;
-	    s->addr = NULL;
-	    s->mblock = NULL;
-	    memset(&s->clink, 0, sizeof(linkdesc));
-	    s->key = 0;
-
-	    if (s->rtag == PLUS) r->link[0] = s->link[1];
-	      else r->link[0] = NULL;
-	    p = s;
-	}
-    }
-  }
-
-/**/ if (Traverser.p==p) Traverser.init=0;
 #if !defined(SINGLESTEP)&&!defined(SINGLEBLOCK)
   if (debug_level('e')>2) e_printf("Remove node %p\n",p);
 #endif
@@ -413,147 +293,40 @@ void avltr_delete (const int key)
 	    leavedos_main(0x9142);
 	}
 #endif
-  if (p->mblock) dlfree(p->mblock);
-  Tfree(p);
-
-  while (--k) {
-      TNode *const s = pa[k];
-
-      if (a[k] == 0) {
-	  TNode *const r = s->link[1];
-
-	  if (s->bal == -1) {
-	      s->bal = 0;
-	      continue;
-	  }
-	  else if (s->bal == 0) {
-	      s->bal = +1;
-	      break;
-	  }
-
-	  if (s->rtag == MINUS || r->bal == 0) {
-	      s->link[1] = r->link[0];
-	      r->link[0] = s;
-	      r->bal = -1;
-	      pa[k - 1]->link[(int) a[k - 1]] = r;
-	      break;
-	  }
-	  else if (r->bal == +1) {
-	      if (r->link[0] != NULL) {
-		  s->rtag = PLUS;
-		  s->link[1] = r->link[0];
-	      }
-	      else
-		s->rtag = MINUS;
-	      r->link[0] = s;
-	      s->bal = r->bal = 0;
-	      pa[k - 1]->link[a[k - 1]] = r;
-	  }
-	  else {
-	      p = r->link[0];
-	      if (p->rtag == PLUS) r->link[0] = p->link[1];
-	        else r->link[0] = NULL;
-	      p->link[1] = r;
-	      p->rtag = PLUS;
-	      if (p->link[0] == NULL) {
-		  s->link[1] = p;
-		  s->rtag = MINUS;
-	      }
-	      else {
-		  s->link[1] = p->link[0];
-		  s->rtag = PLUS;
-	      }
-	      p->link[0] = s;
-	      if (p->bal == +1)	s->bal = -1, r->bal = 0;
-	        else if (p->bal == 0) s->bal = r->bal = 0;
-		  else s->bal = 0, r->bal = +1;
-	      p->bal = 0;
-	      pa[k - 1]->link[(int) a[k - 1]] = p;
-	      if (a[k - 1] == 1) pa[k - 1]->rtag = PLUS;
-	  }
-      }
-      else {
-	  TNode *const r = s->link[0];
-
-	  if (s->bal == +1) {
-	      s->bal = 0;
-	      continue;
-	  }
-	  else if (s->bal == 0) {
-	      s->bal = -1;
-	      break;
-	  }
-
-	  if (s->link[0] == NULL || r->bal == 0) {
-	      s->link[0] = r->link[1];
-	      r->link[1] = s;
-	      r->bal = +1;
-	      pa[k - 1]->link[(int) a[k - 1]] = r;
-	      break;
-	  }
-	  else if (r->bal == -1) {
-	      if (r->rtag == PLUS) s->link[0] = r->link[1];
-	        else s->link[0] = NULL;
-	      r->link[1] = s;
-	      r->rtag = PLUS;
-	      s->bal = r->bal = 0;
-	      pa[k - 1]->link[a[k - 1]] = r;
-	  }
-	  else {
-	      p = r->link[1];
-	      if (p->link[0] != NULL) {
-		  r->rtag = PLUS;
-		  r->link[1] = p->link[0];
-	      }
-	      else
-		r->rtag = MINUS;
-	      p->link[0] = r;
-	      if (p->rtag == MINUS) s->link[0] = NULL;
-	        else s->link[0] = p->link[1];
-	      p->link[1] = s;
-	      p->rtag = PLUS;
-	      if (p->bal == -1)	s->bal = +1, r->bal = 0;
-	        else if (p->bal == 0) s->bal = r->bal = 0;
-		  else s->bal = 0, r->bal = -1;
-	      p->bal = 0;
-	      if (a[k - 1] == 1)
-		pa[k - 1]->rtag = PLUS;
-	      pa[k - 1]->link[(int) a[k - 1]] = p;
-	  }
-      }
+  if (p->mblock) {
+	CodeCacheBytes -= dlmalloc_usable_size(p->mblock);
+	dlfree(p->mblock);
   }
+  Tfree(p);
 }
 
 #endif	// HOST_ARCH_X86
 
 /////////////////////////////////////////////////////////////////////////////
 
-static void avltr_init(void)
+static void tdir_init(void)
 {
 #ifdef HOST_ARCH_X86
  if (!config.cpusim) {
   int i;
   TNode *G;
 
-  CollectTree.root.link[0] = NULL;
-  CollectTree.root.link[1] = &CollectTree.root;
-  CollectTree.root.rtag = PLUS;
-  CollectTree.count = 0;
-  Traverser.init = 0;
-  Traverser.p = NULL;
+  NodeList.next = NodeList.prev = &NodeList;
+  Traverser = &NodeList;
+  memset(findtree_cache, 0, sizeof(findtree_cache));
 
   G = TNodePool;
   for (i=0; i<(NODES_IN_POOL-1); i++) {
 	TNode *G1 = G; G++;
-	G1->link[0] = G;
+	G1->next = G;
   }
-  G->link[0] = TNodePool;
+  G->next = TNodePool;
 
   InstrMeta = malloc(sizeof(IMeta) * MAXINODES);
   memset(InstrMeta, 0, sizeof(IMeta));
  }
 #endif
-  g_printf("avltr_init\n");
+  g_printf("tdir_init\n");
   CurrIMeta = -1;
   NodesCleaned = 0;
   ninodes = 0;
@@ -562,16 +335,16 @@ static void avltr_init(void)
 
 #ifdef HOST_ARCH_X86
 
-void avltr_destroy(void)
+void tdir_destroy(void)
 {
-  avltr_tree *tree;
+  TNode *G;
+  int i, j;
 #if PROFILE
   hitimer_t t0 = 0;
 #endif
 
-  tree = &CollectTree;
   e_printf("--------------------------------------------------------------\n");
-  e_printf("Destroy AVLtree with %d nodes\n",ninodes);
+  e_printf("Destroy block directory with %d nodes\n",ninodes);
   e_printf("--------------------------------------------------------------\n");
 #ifdef DEBUG_TREE
   DumpTree (tLog);
@@ -581,41 +354,27 @@ void avltr_destroy(void)
 #endif
 
   mprot_end();
-  if (tree->root.link[0] != &tree->root) {
-      TNode *an[AVL_MAX_HEIGHT];	/* Stack A: nodes. */
-      char ab[AVL_MAX_HEIGHT];		/* Stack A: bits. */
-      int ap = 0;			/* Stack A: height. */
-      TNode *p = tree->root.link[0];
-
-      for (;;) {
-	  while (p != NULL) {
-	      ab[ap] = 0;
-	      an[ap++] = p;
-	      p = p->link[0];
-	  }
-
-	  for (;;) {
-	      backref *B;
-	      if (ap == 0) goto quit;
-
-	      p = an[--ap];
-	      if (ab[ap] == 0) {
-		  ab[ap++] = 1;
-		  if (p->rtag == MINUS) continue;
-		  p = p->link[1];
-		  break;
-	      }
-	      B = p->clink.bkr.next;
-	      while (B) {
-		  backref *B2 = B;
-		  B = B->next;
-		  free(B2);
-	      }
-	      if (p->mblock) dlfree(p->mblock);
-	  }
+  for (G = NodeList.next; G != &NodeList; G = G->next) {
+      backref *B = G->clink.bkr.next;
+      while (B) {
+	  backref *B2 = B;
+	  B = B->next;
+	  free(B2);
       }
+      if (G->mblock) dlfree(G->mblock);
+  }
+  NodeList.next = NodeList.prev = &NodeList;
+  Traverser = &NodeList;
+  CodeCacheBytes = 0;
+
+  for (i = 0; i < (1 << TDIR_L1_BITS); i++) {
+      tpage *T = tdir[i];
+      if (T == NULL) continue;
+      for (j = 0; j < (1 << TDIR_L2_BITS); j++)
+	  free(T[j].nodes);
+      free(T);
+      tdir[i] = NULL;
   }
-quit:
   free(InstrMeta);
 #if PROFILE
   if (debug_level('e')) {
@@ -635,15 +394,12 @@ quit:
  */
 unsigned int FindPC(unsigned char *addr)
 {
-  TNode *G = &CollectTree.root;
+  TNode *G;
   unsigned char *ahE;
   Addr2Pc *AP;
   unsigned int i;
 
-  for (;;) {
-      /* walk to next node */
-      G = NEXTNODE(G);
-      if (G == &CollectTree.root) break;
+  for (G = NodeList.next; G != &NodeList; G = G->next) {
       if (!G->addr || !G->pmeta || G->alive<=0) continue;
       ahE = G->addr + G->len;
       if (!ADDR_IN_RANGE(addr,G->addr,ahE)) continue;
@@ -660,13 +416,14 @@ unsigned int FindPC(unsigned char *addr)
   return 0;
 }
 
+
 /////////////////////////////////////////////////////////////////////////////
 
 #ifdef DEBUG_LINKER
 
 static void CheckLinks(void)
 {
-  TNode *G = &CollectTree.root;
+  TNode *G = &NodeList;
   TNode *GL;
   unsigned char *p;
   linkdesc *L, *T;
@@ -675,8 +432,8 @@ static void CheckLinks(void)
 
   for (;;) {
     /* walk to next node */
-    G = NEXTNODE(G);
-    if (G == &CollectTree.root) {
+    G = G->next;
+    if (G == &NodeList) {
 	e_printf("DEBUG: node link check ok\n");
 	return;
     }
@@ -783,7 +540,7 @@ nquit:
 
 void DumpTree (FILE *fd)
 {
-  TNode *G = &CollectTree.root;
+  TNode *G = &NodeList;
   linkdesc *L;
   backref *B;
   int nn;
@@ -794,8 +551,8 @@ void DumpTree (FILE *fd)
 
   while (nn < 10000) {		// sorry,only 4 digits available
     /* walk to next node */
-    G = NEXTNODE(G);
-    if (G == &CollectTree.root) {
+    G = G->next;
+    if (G == &NodeList) {
 	fprintf(fd,"\n== EOT ====================================================\n");
 	fflush(fd);
 	return;
@@ -808,8 +565,6 @@ void DumpTree (FILE *fd)
     }
     fprintf(fd,"%04d Node %p at %08x..%08x mblock=%p flags=%#x\n",
 	nn,G,G->key,(G->seqbase+G->seqlen-1),G->mblock,G->flags);
-    fprintf(fd,"     AVL (%p:%p),%d,%d,%d,%d\n",G->link[0],G->link[1],
-		G->bal,G->cache,G->pad,G->rtag);
     fprintf(fd,"     source:     instr=%d, len=%#x\n",G->seqnum,G->seqlen);
     fprintf(fd,"     translated: len=%#x\n",G->len);
     L = &G->clink;
@@ -872,18 +627,11 @@ static int TraverseAndClean(void)
   if (debug_level('e')) t0 = GETTSC();
 #endif
 
-  if (Traverser.init == 0) {
-      Traverser.p = G = &CollectTree.root;
-      Traverser.init = 1;
-  }
-  else
-      G = Traverser.p;
-
   /* walk to next node */
-  G = NEXTNODE(G);
-  if (G == &CollectTree.root) {
-      G = NEXTNODE(G);
-      if (G == &CollectTree.root)
+  G = Traverser->next;
+  if (G == &NodeList) {
+      G = G->next;
+      if (G == &NodeList)
           return 0;
   }
 
@@ -897,14 +645,15 @@ static int TraverseAndClean(void)
   }
   if ((G->addr == NULL) || (G->alive<=0)) {
       if (debug_level('e')>2) e_printf("Delete node %08x\n",G->key);
-      avltr_delete(G->key);
+      Traverser = G->prev;
+      tdir_delete(G->key);
       cnt++;
   }
   else {
       if (debug_level('e')>3)
 	e_printf("TraverseAndClean: node at %08x of %d life=%d\n",
 		G->key,ninodes,G->alive);
-      Traverser.p = G;
+      Traverser = G;
   }
 #if PROFILE
   if (debug_level('e')) CleanupTime += (GETTSC() - t0);
@@ -913,7 +662,47 @@ static int TraverseAndClean(void)
 }
 
 /*
- * Add a node to the collector tree.
+ * Keep the translated code within the $_cpuemu_cache_size budget.
+ * The cleaner list is used as the ring of a clock: a node found by
+ * FindTree() since the hand last passed still has its full life and
+ * gets a second chance, the others are evicted until the code fits.
+ * keep is the node just created, which is about to be executed.
+ */
+static void CodeCacheTrim(TNode *keep)
+{
+  unsigned long budget = (unsigned long)config.cpuemu_cachesize << 10;
+  int steps = 2 * ninodes + 1;
+
+  while (CodeCacheBytes > budget && steps-- > 0) {
+      TNode *G = Traverser->next;
+
+      if (G == &NodeList) {
+	  G = G->next;
+	  if (G == &NodeList)
+	      break;
+      }
+      if (G == keep) {
+	  Traverser = G;
+	  continue;
+      }
+      if (G->addr && G->alive > 0) {
+	  if (G->alive >= NODELIFE(G)) {
+	      G->alive = NODELIFE(G) - 1;
+	      Traverser = G;
+	      continue;
+	  }
+	  if (debug_level('e')>2) e_printf("Evict node at %08x\n",G->key);
+	  e_unmarkpage(G->seqbase, G->seqlen);
+	  NodeUnlinker(G);
+	  CodeCacheEvictions++;
+      }
+      Traverser = G->prev;
+      tdir_delete(G->key);
+  }
+}
+
+/*
+ * Add a node to the block directory.
  * The code is linearly stored in the CodeBuf and its associated structures
  * are in the InstrMeta array. We allocate a buffer and copy the code, then
  * we copy the sequence data from the head element of InstrMeta. In this
@@ -929,14 +718,14 @@ TNode *Move2Tree(IMeta *I0, CodeBuf *GenCodeBuf)
   if (debug_level('e')) t0 = GETTSC();
 #endif
   int key;
-  int len, found, nap;
+  int len, nap;
   IMeta *I;
   int i, apl=0;
   Addr2Pc *ap;
   CodeBuf *mallmb;
   void **cp;
 
-  /* try to keep a limit to the number of nodes in the tree. 3000-4000
+  /* try to keep a limit to the number of nodes in the index. 3000-4000
    * nodes are probably enough before performance starts to suffer */
   if (ninodes > NodeLimit) {
 	for (i=0; i<CreationIndex; i++) TraverseAndClean();
@@ -944,21 +733,29 @@ TNode *Move2Tree(IMeta *I0, CodeBuf *GenCodeBuf)
 
   key = I0->npc;
 
-  found = 0;
-  nG = avltr_probe(key, &found);
-/**/ if (nG==NULL) leavedos_main(0x8201);
+  nG = tdir_find(key);
 
-  if (found) {
+  if (nG) {
 	if (debug_level('e')>2) {
 		e_printf("Equal keys: replace node %p at %08x\n",
 			nG,key);
 	}
 	/* ->REPLACE the code of the node found with the latest
-	   compiled version */
+	   compiled version. The source range can be different, so
+	   take it out of the directory and re-insert it below */
 	NodeUnlinker(nG);
-	if (nG->mblock) dlfree(nG->mblock);
+	if (nG->mblock) {
+	    CodeCacheBytes -= dlmalloc_usable_size(nG->mblock);
+	    dlfree(nG->mblock);
+	}
+	tdir_remove(nG);
   }
   else {
+	nG = Tmalloc();
+	ninodes++;
+#if PROFILE
+	if (debug_level('e')) if (ninodes > MaxNodes) MaxNodes = ninodes;
+#endif
 #if !defined(SINGLESTEP)&&!defined(SINGLEBLOCK)
 	if (debug_level('e')>2) {
 		e_printf("New TNode %d at=%p key=%08x\n",
@@ -969,11 +766,15 @@ TNode *Move2Tree(IMeta *I0, CodeBuf *GenCodeBuf)
 	}
 #endif
 	nG->key = key;
+	/* new nodes go just behind the cleaner, so that they
+	   get a full round of life before being aged */
+	list_add(nG, Traverser->prev);
   }
 
   /* transfer info from first node of the Meta list to our new node */
   nG->seqbase = I0->seqbase;
   nG->seqlen = I0->seqlen;
+  tdir_insert(nG);
   nG->seqnum = I0->ncount;
 #if PROFILE
   if (debug_level('e')) if (nG->len > MaxNodeSize) MaxNodeSize = nG->len;
@@ -981,21 +782,21 @@ TNode *Move2Tree(IMeta *I0, CodeBuf *GenCodeBuf)
   nG->len = len = I0->totlen;
   nG->flags = I0->flags;
   nG->alive = NODELIFE(nG);
+  nG->execs = 0;
   findtree_cache[key&FINDTREE_CACHE_HASH_MASK] = nG;
 
   /* allocate the extra memory used by the node. This includes the
    * translated code plus the table of correspondences between source
    * and translated addresses.
    * The first longword of the memory block is special; it stores a
-   * back-pointer to the node. This because nodes can be moved in
-   * memory when rebalancing the AVL tree, while we need absolute and
-   * constant memory references.
+   * back-pointer to the node, which is what the linker refers to.
    * The second longword is equal to its own address. Guess why.
    * After that come the offset table, then the code.
    */
   nap = nG->seqnum+1;
   mallmb = GenCodeBuf;
   nG->mblock = GenCodeBuf;
+  CodeCacheBytes += dlmalloc_usable_size(GenCodeBuf);
   nG->mblock->bkptr = nG;
   cp = &nG->mblock->selfptr;
   *cp = cp;
@@ -1045,6 +846,9 @@ TNode *Move2Tree(IMeta *I0, CodeBuf *GenCodeBuf)
 #endif
   CurrIMeta = -1;
   memset(&InstrMeta[0],0,sizeof(IMeta));
+  if (config.cpuemu_cachesize &&
+      CodeCacheBytes > ((unsigned long)config.cpuemu_cachesize << 10))
+	CodeCacheTrim(nG);
 #if PROFILE
   if (debug_level('e')) AddTime += (GETTSC() - t0);
 #endif
@@ -1052,6 +856,53 @@ TNode *Move2Tree(IMeta *I0, CodeBuf *GenCodeBuf)
 }
 
 
+/*
+ * Hot trace formation.
+ * Every exit from a node which is not linked costs a return to
+ * FindExecCode() and a new prologue/epilogue pair. When a node gets hot
+ * and ends with a direct near jmp into a node which can only be
+ * entered through that jmp, both nodes are better off translated as
+ * one: the jmp disappears and the code runs straight through.
+ * If this is the case, remember the jmp and the target and return 1;
+ * the caller then drops the node and the interpreter parses it again,
+ * going on at the target when it reaches the jmp (see _JumpGen).
+ */
+int HotTrace(TNode *G)
+{
+  TNode *T;
+  backref *B;
+  unsigned int jpc, lo, hi;
+  unsigned char opc;
+
+  if (G->clink.t_type != JMP_LINK || G->clink.t_ref == NULL ||
+      G->seqnum == 0)
+	return 0;
+  T = *G->clink.t_ref;
+  if (T == G || T->alive <= 0 || T->cs != G->cs || T->mode != G->mode)
+	return 0;
+  /* the only way into T must be G: one backref and no entries from C
+     except the one following its translation */
+  B = T->clink.bkr.next;
+  if (B == NULL || B->next || *B->ref != G || T->execs > 1)
+	return 0;
+  /* JMP_LINK is also used for calls and far jumps */
+  jpc = G->key + G->pmeta[G->seqnum-1].dnpc;
+  opc = Fetch(jpc);
+  if (opc != JMPsid && opc != JMPd)
+	return 0;
+  lo = G->seqbase < T->seqbase ? G->seqbase : T->seqbase;
+  hi = G->seqbase + G->seqlen;
+  if (T->seqbase + T->seqlen > hi) hi = T->seqbase + T->seqlen;
+  if (hi - lo >= TRACE_MAXLEN)
+	return 0;
+  if (debug_level('e')>1)
+	e_printf("Hot trace %08x->%08x, jmp at %08x\n",G->key,T->key,jpc);
+  TraceJmp = jpc;
+  TraceTarget = T->key;
+  return 1;
+}
+
+
 TNode *FindTree(int key)
 {
   TNode *I;
@@ -1065,8 +916,7 @@ TNode *FindTree(int key)
 	TheCPU.sigprof_pending = 0;
   }
 
-  /* fast path: using cache indexed by low 12 bits of PC:
-     ~99.99% success rate */
+  /* fast path: using cache indexed by low 12 bits of PC */
   I = findtree_cache[key&FINDTREE_CACHE_HASH_MASK];
   if (I && (I->alive>0) && (I->key==key)) {
 	if (debug_level('e')) {
@@ -1077,34 +927,23 @@ TNode *FindTree(int key)
 #endif
 	}
 	I->alive = NODELIFE(I);
+	CodeCacheHits++;
 	return I;
   }
-  if (!e_querymark(key, 1))
+  if (!e_querymark(key, 1)) {
+	CodeCacheMisses++;
 	return NULL;
+  }
 
 #if PROFILE
   if (debug_level('e')) t0 = GETTSC();
 #endif
-  I = CollectTree.root.link[0];
-  if (I == NULL) return NULL;	/* always NULL the first time! */
-
-  for (;;) {
-      int diff = (key - I->key);
-
-      if (diff < 0) {
-	  I = I->link[0];
-	  if (I == NULL) goto endsrch;
-      }
-      else if (diff > 0) {
-	  if (I->rtag == MINUS) goto endsrch;
-	  I = I->link[1];
-      }
-      else break;
-  }
+  I = tdir_find(key);
 
   if (I && I->addr && (I->alive>0)) {
 	if (debug_level('e')>3) e_printf("Found key %08x\n",key);
 	I->alive = NODELIFE(I);
+	CodeCacheHits++;
 	findtree_cache[key&FINDTREE_CACHE_HASH_MASK] = I;
 #if PROFILE
 	if (debug_level('e')) {
@@ -1115,7 +954,6 @@ TNode *FindTree(int key)
 	return I;
   }
 
-endsrch:
 #if PROFILE
   if (debug_level('e')) SearchTime += (GETTSC() - t0);
 #endif
@@ -1127,6 +965,7 @@ endsrch:
 	tccount=0;
   }
 
+  CodeCacheMisses++;
   if (debug_level('e')) {
     if (debug_level('e')>4) e_printf("Not found key %08x\n",key);
 #if PROFILE
@@ -1180,18 +1019,10 @@ static void BreakNode(TNode *G, unsigned char *eip)
   e_printf("============ Node %08x break failed\n",G->key);
 }
 
-static TNode *DoDelNode(TNode *G)
-{
-  if (Traverser.p == G)
-    Traverser.p = NEXTNODE(G);
-  avltr_delete(G->key);
-  return CollectTree.root.link[0];
-}
-
-int InvalidateNodeRange(int al, int len, unsigned char *eip)
+int InvalidateNodeRange(int al, int len, unsigned char *eip, int cause)
 {
-  TNode *G;
   int ah;
+  unsigned int page, p1;
   int cleaned = 0;
 #if PROFILE
   hitimer_t t0 = 0;
@@ -1201,45 +1032,26 @@ int InvalidateNodeRange(int al, int len, unsigned char *eip)
   ah = al + len;
   if (debug_level('e')>1) dbug_printf("Invalidate area %08x..%08x\n",al,ah);
 
-  G = CollectTree.root.link[0];
-  if (G == NULL) goto quit;
-  /* find nearest (lesser than) node */
-  for (;;) {
-      if (G == NULL) goto quit;
-      if (G->key > al) {
-	/* no need to check for dead node here as the left-most
-	 * node will not be overlapped by anything from left */
-	if (G->link[0]==NULL) break;
-	G = G->link[0];
-      }
-      else if (G->key < al) {
-        TNode *G2;
-	G2 = G->link[1];
-	if (G2 == &CollectTree.root || G2->key > al) {
-	  if (G->alive <= 0) {
-	    /* remove dead node as it may be overlapped by good one */
-	    G = DoDelNode(G);
-	    continue;
-	  }
-	  break;
-	} else G = G2;
-      }
-      else {
-	if (G->alive <= 0) {
-	  G = DoDelNode(G);
+  /* only the nodes on the pages of the range can overlap it */
+  page = (unsigned int)al >> PAGE_SHIFT;
+  p1 = (unsigned int)(len > 0 ? ah - 1 : al) >> PAGE_SHIFT;
+  do {
+      tpage *P = tdir_page(page, 0);
+      int i;
+
+      if (P == NULL) {
+	  /* skip the whole second-level table */
+	  page |= (1 << TDIR_L2_BITS) - 1;
+	  if (page >= p1) break;
 	  continue;
-	}
-	break;
       }
-  }
-  if (debug_level('e')>1) e_printf("Invalidate from node %08x on\n",G->key);
+      for (i = 0; i < P->count; i++) {
+	TNode *G = P->nodes[i];
+	int ahG;
 
-  /* walk tree in ascending, hopefully sorted, address order */
-  for (;;) {
-      if (G == &CollectTree.root || G->key >= ah)
-        break;
-      if (G->addr && (G->alive>0)) {
-	int ahG = G->seqbase + G->seqlen;
+	if (!G->addr || (G->alive<=0))
+	    continue;
+	ahG = G->seqbase + G->seqlen;
 	if (RANGE_IN_RANGE(G->seqbase,ahG,al,ah)) {
 	    unsigned char *ahE = G->addr + G->len;
 	    if (debug_level('e')>1)
@@ -1247,8 +1059,14 @@ int InvalidateNodeRange(int al, int len, unsigned char *eip)
 	    G->alive = 0;
 	    e_unmarkpage(G->seqbase, G->seqlen);
 	    NodeUnlinker(G);
+	    /* queue it for deletion: the cleaner visits it next */
+	    if (G != Traverser) {
+		list_del(G);
+		list_add(G, Traverser);
+	    }
 	    cleaned++;
 	    NodesCleaned++;
+	    NodesInvalidated[cause]++;
 	    /* if the current eip is in *any* chunk of code that is deleted
 	        (not just the one written to)
 	       then we need to break the node immediately to go back to
@@ -1264,9 +1082,8 @@ int InvalidateNodeRange(int al, int len, unsigned char *eip)
 	    }
 	}
       }
-      G = NEXTNODE(G);
-  }
-quit:
+  } while (page++ != p1);
+
   if (debug_level('e') && e_querymark(al, len))
     error("simx86: InvalidateNodeRange did not clear all code for %#08x, len=%x\n",
 	  al, len);
@@ -1281,14 +1098,14 @@ quit:
 
 
 /////////////////////////////////////////////////////////////////////////////
-static void do_invalidate(unsigned data, int cnt)
+static void do_invalidate(unsigned data, int cnt, int cause)
 {
 	cnt = PAGE_ALIGN(data+cnt-1) - (data & _PAGE_MASK);
 	data &= _PAGE_MASK;
 #ifdef HOST_ARCH_X86
 	/* e_querymprotrange prevents coming here for sim */
 	assert (!config.cpusim);
-	InvalidateNodeRange(data, cnt, 0);
+	InvalidateNodeRange(data, cnt, 0, cause);
 #endif
 }
 
@@ -1307,13 +1124,13 @@ void e_invalidate(unsigned data, int cnt)
 		if (e_querymark(data, cnt)) {
 			// no need to invalidate the whole page here,
 			// as the page does not need to be unprotected
-			InvalidateNodeRange(data, cnt, 0);
+			InvalidateNodeRange(data, cnt, 0, INV_WRITE);
 			return;
 		}
 #endif
 		return;
 	}
-	do_invalidate(data, cnt);
+	do_invalidate(data, cnt, INV_WRITE);
 }
 
 void e_invalidate_pa(unsigned pa, int cnt)
@@ -1342,7 +1159,7 @@ void e_invalidate_full(unsigned data, int cnt)
 	/* nothing to invalidate if there are no page protections */
 	if (!e_querymprotrange(data, cnt))
 		return;
-	do_invalidate(data, cnt);
+	do_invalidate(data, cnt, INV_REMAP);
 }
 
 int e_invalidate_page_full(unsigned data)
@@ -1354,7 +1171,7 @@ int e_invalidate_page_full(unsigned data)
 	/* nothing to invalidate if there are no page protections */
 	if (!e_querymprotrange(data, cnt))
 		return 0;
-	do_invalidate(data, cnt);
+	do_invalidate(data, cnt, INV_REMAP);
 	return 1;
 }
 
@@ -1516,21 +1333,27 @@ void InitTrees(void)
 	    TNodePool = calloc(NODES_IN_POOL, sizeof(TNode));
 #endif
 
-	avltr_init();
+	tdir_init();
 
 #ifdef HOST_ARCH_X86
 	if (!config.cpusim && debug_level('e')>1) {
-	    e_printf("Root tree node at %p\n",&CollectTree.root);
+	    e_printf("Node list at %p\n",&NodeList);
 	    e_printf("TNode pool at %p\n",TNodePool);
 	}
+	if (!config.cpusim)
+	    pcache_init();
 #endif
 	NodesParsed = NodesExecd = 0;
 	CleanFreq = 8;
 	cstx = xCS1 = 0;
 	CreationIndex = 0;
+	NodeEntries = NodeLinks = TracesBuilt = ColdBlocks = CTlbHits = 0;
+	CodeCacheHits = CodeCacheMisses = CodeCacheEvictions = 0;
+	memset(NodesInvalidated, 0, sizeof(NodesInvalidated));
+	TraceJmp = TraceTarget = 0;
 #if PROFILE
 	if (debug_level('e')) {
-	    MaxDepth = MaxNodes = MaxNodeSize = 0;
+	    MaxPageNodes = MaxNodes = MaxNodeSize = 0;
 	    TotalNodesParsed = TotalNodesExecd = 0;
 	    NodesFound = NodesFastFound = NodesNotFound = 0;
 	    TreeCleanups = 0;
@@ -1551,7 +1374,8 @@ void EndGen(void)
 	CurrIMeta = -1;
 #ifdef HOST_ARCH_X86
 	if (!config.cpusim) {
-	    avltr_destroy();
+	    pcache_end();
+	    tdir_destroy();
 	    free(TNodePool); TNodePool=NULL;
 	}
 #endif
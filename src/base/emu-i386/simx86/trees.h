@@ -30,13 +30,6 @@
  *  (linux/arch/i386/kernel/vm86.c). This code originaly was written by
  *  Linus Torvalds with later enhancements by Lutz Molgedey and Hans Lermen.
  *
- * 2. The tree handling routines were adapted from libavl:
- *  libavl - manipulates AVL trees.
- *  Copyright (C) 1998, 1999 Free Software Foundation, Inc.
- *  The author may be contacted at <pfaffben@pilot.msu.edu> on the
- *  Internet, or as Ben Pfaff, 12167 Airport Rd, DeWitt MI 48820, USA
- *  through more mundane means.
- *
  ***************************************************************************/
 
 #ifndef _EMU86_TREES_H
@@ -47,11 +40,11 @@
 // Tree node key definition.
 //
 
-struct avltr_node;
+struct _tnode;
 
 typedef struct _bkref {
 	struct _bkref *next;
-	struct avltr_node **ref;
+	struct _tnode **ref;
 	char branch;
 } backref;
 
@@ -71,7 +64,7 @@ typedef struct _lnkdesc {
 	} nt_link;
 	unsigned int t_target, nt_target;
 	unsigned unlinked_jmp_targets;
-	struct avltr_node **t_ref, **nt_ref;
+	struct _tnode **t_ref, **nt_ref;
 	backref bkr;
 } linkdesc;
 
@@ -95,7 +88,7 @@ typedef struct _imeta {
 } IMeta;
 
 typedef struct _codebufhdr {
-	struct avltr_node *bkptr;
+	struct _tnode *bkptr;
 	void *selfptr;
 	Addr2Pc meta[0]; /* there are nap of these */
 	/* behind these follows the code */
@@ -109,24 +102,17 @@ extern int NodesParsed;
 extern int TotalNodesParsed;
 extern int MaxNodes;
 extern int MaxNodeSize;
-extern int MaxDepth;
+extern unsigned int MaxPageNodes;
 extern int NodesNotFound;
 extern int NodesFastFound;
 extern int EmuSignals;
 extern int NodesFound;
 extern int TreeCleanups;
 
-typedef struct avltr_node
+typedef struct _tnode
 {
-/* ----- Structure for a node in a right-threaded AVL tree. ----- */
-    struct avltr_node *link[2];	/* Subtrees or threads. */
-    signed char bal;		/* Balance factor. */
-    char cache;			/* Used during insertion. */
-    char pad;			/* Reserved for fully threaded trees. */
-    signed char rtag;		/* Right thread tag. */
-/* -------------------------------------------------------------- */
-	int key;		/* signed! and don't move it from here! */
-/* -------------------------------------------------------------- */
+	struct _tnode *next, *prev;	/* list walked by the cleaner */
+	int key;
 	int alive;
 	CodeBuf *mblock;
 	unsigned char *addr;
@@ -136,33 +122,36 @@ typedef struct avltr_node
 	linkdesc clink;
 	unsigned cs;
 	unsigned mode;
+	unsigned int execs;	/* times entered from FindExecCode */
 } TNode;
 
-/* Used for traversing a right-threaded AVL tree. */
-typedef struct avltr_traverser
-{
-    int init;				/* Initialized? */
-    struct avltr_node *p;		/* Last node returned. */
-} avltr_traverser;
-
-/* Structure which holds information about a threaded AVL tree. */
-typedef struct avltr_tree
-{
-    struct avltr_node root;	/* Tree root node. */
-    int count;			/* Number of nodes in the tree. */
-} avltr_tree;
-
-/* Tag types. */
-#define PLUS +1
-#define MINUS -1
+/* why translated code was thrown away */
+enum {
+	INV_WRITE,	/* written to by the emulator or DOS services */
+	INV_PATCH,	/* written to by patched code */
+	INV_FAULT,	/* written to, caught by a page fault */
+	INV_REMAP,	/* the memory was remapped or unprotected */
+	INV_CODE,	/* replaced by the translator itself */
+	INV_CAUSES
+};
+extern int NodesInvalidated[INV_CAUSES];
 
 #ifdef HOST_ARCH_X86
-extern avltr_tree CollectTree;
-
-void avltr_delete (const int key);
+void tdir_delete (const int key);
 //
 TNode *FindTree(int key);
 TNode *Move2Tree(IMeta *I0, CodeBuf *GenCodeBuf);
+int HotTrace(TNode *G);
+extern unsigned int TraceJmp, TraceTarget;
+extern int TracesBuilt;
+extern int NodeEntries;
+extern int NodeLinks;
+extern int ColdBlocks;
+extern int ninodes;
+extern unsigned long CodeCacheBytes;
+extern int CodeCacheHits;
+extern int CodeCacheMisses;
+extern int CodeCacheEvictions;
 //
 #endif
 
@@ -170,7 +159,7 @@ void InitTrees(void);
 
 #ifdef HOST_ARCH_X86
 unsigned int FindPC(unsigned char *addr);
-int InvalidateNodeRange(int addr, int len, unsigned char *eip);
+int InvalidateNodeRange(int addr, int len, unsigned char *eip, int cause);
 #endif
 
 #endif
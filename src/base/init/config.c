@@ -185,6 +185,8 @@ void dump_config_status(void (*printfunc)(const char *, ...))
         config.umb_a0, config.umb_b0, config.umb_f0, config.dos_up);
     (*print)("dpmi 0x%x\ndpmi_base 0x%x\npm_dos_api %i\nignore_djgpp_null_derefs %i\n",
         config.dpmi, config.dpmi_base, config.pm_dos_api, config.no_null_checks);
+    (*print)("huge_pages %i\ndpmi_lazy_commit %i\n",
+        config.huge_pages, config.dpmi_lazy_commit);
     (*print)("mapped_bios %d\nvbios_file %s\n",
         config.mapped_bios, (config.vbios_file ? config.vbios_file :""));
     (*print)("vbios_copy %d\nvbios_seg 0x%x\nvbios_size 0x%x\n",
@@ -314,6 +314,14 @@ static void *mem_reserve(uint32_t memsize)
     perror ("LOWRAM mmap");
     exit(EXIT_FAILURE);
   }
+#ifdef MADV_HUGEPAGE
+  /* The reservation is private anonymous memory aligned to 2Mb, so the
+     kernel can back it with transparent huge pages. Pages that get
+     different protections (DPMI page attributes, uncommitted pages)
+     only split the huge page they are in. */
+  if (config.huge_pages && madvise(result, memsize, MADV_HUGEPAGE) == -1)
+    warn("MADV_HUGEPAGE failed: %s\n", strerror(errno));
+#endif
   return result;
 }
 
@@ -392,6 +400,8 @@ void low_mem_init(void)
     memcheck_reserve('x', LOWMEM_SIZE + EXTMEM_SIZE, XMS_SIZE);
 
   sminit_comu(&main_pool, mem_base, memsize, mcommit, muncommit);
+  /* muncommit() drops the pages, so they read as zeroes when reused */
+  smset_zero_commit(&main_pool, config.dpmi_lazy_commit);
   ptr = smalloc(&main_pool, LOWMEM_SIZE + HMASIZE);
   assert(ptr == mem_base);
   /* smalloc uses PROT_READ | PROT_WRITE, needs to add PROT_EXEC here */
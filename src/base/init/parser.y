@@ -234,7 +234,7 @@ enum {
 %token ETHDEV TAPDEV VDESWITCH SLIRPARGS NETSOCK VNET
 %token DEBUG MOUSE SERIAL COM KEYBOARD TERMINAL VIDEO EMURETRACE TIMER
 %token MATHCO CPU CPUSPEED BOOTDRIVE SWAP_BOOTDRIVE
-%token L_XMS L_DPMI DPMI_BASE PM_DOS_API NO_NULL_CHECKS
+%token L_XMS L_DPMI DPMI_BASE HUGE_PAGES DPMI_LAZY_COMMIT PM_DOS_API NO_NULL_CHECKS
 %token PORTS DISK DOSMEM EXT_MEM
 %token L_EMS UMB_A0 UMB_B0 UMB_F0 HMA DOS_UP
 %token EMS_SIZE EMS_FRAME EMS_UMA_PAGES EMS_CONV_PAGES
@@ -242,11 +242,12 @@ enum {
 %token ABORT WARN ERROR
 %token L_FLOPPY EMUSYS L_X L_SDL
 %token DOSEMUMAP LOGBUFSIZE LOGFILESIZE MAPPINGDRIVER
-%token LFN_SUPPORT FFS_REDIR SET_INT_HOOKS TRACE_IRETS FINT_REVECT
+%token LFN_SUPPORT SHM_LOCKS FFS_REDIR SET_INT_HOOKS TRACE_IRETS FINT_REVECT
 	/* speaker */
 %token EMULATED NATIVE
 	/* cpuemu */
-%token CPUEMU CPU_VM CPU_VM_DPMI VM86 KVM
+%token CPUEMU CPUEMU_CACHE CPUEMU_FAST_FPU CPUEMU_CACHE_SIZE CPU_VM CPU_VM_DPMI VM86 KVM
+%token KVM_FAST_IO
 	/* keyboard */
 %token RAWKEYBOARD
 %token PRESTROKE
@@ -437,6 +438,10 @@ line:		CHARSET '{' charset_flags '}' {}
 		    {
 		    config.lfn = ($2!=0);
 		    }
+		| SHM_LOCKS bool
+		    {
+		    config.shm_locks = ($2!=0);
+		    }
 		| FINT_REVECT bool
 		    {
 		    config.force_revect = ($2 == -2 ? 1 : $2);
@@ -479,12 +484,45 @@ line:		CHARSET '{' charset_flags '}' {}
 			c_printf("CONF: CPU VM set to %d for DPMI\n",
 				 config.cpu_vm_dpmi);
 			}
+		| KVM_FAST_IO bool
+			{
+			config.kvm_fastio = ($2!=0);
+			c_printf("CONF: KVM fast port I/O %s\n",
+				 config.kvm_fastio ? "on" : "off");
+			}
 		| CPUEMU INTEGER
 			{
 #ifdef X86_EMULATOR
 			config.cpusim = $2;
 			c_printf("CONF: CPUEMU set to %s\n",
 				config.cpusim ? "sim" : "jit");
+#endif
+			}
+		| CPUEMU_CACHE string_expr
+			{
+#ifdef X86_EMULATOR
+			free(config.cpuemu_cache);
+			config.cpuemu_cache = $2;
+			c_printf("CONF: CPUEMU cache file %s\n",
+				config.cpuemu_cache);
+#else
+			free($2);
+#endif
+			}
+		| CPUEMU_FAST_FPU bool
+			{
+#ifdef X86_EMULATOR
+			config.cpuemu_fastfpu = ($2!=0);
+			c_printf("CONF: CPUEMU FPU precision %s\n",
+				config.cpuemu_fastfpu ? "double" : "guest");
+#endif
+			}
+		| CPUEMU_CACHE_SIZE expression
+			{
+#ifdef X86_EMULATOR
+			config.cpuemu_cachesize = $2;
+			c_printf("CONF: CPUEMU code cache size %dk\n",
+				config.cpuemu_cachesize);
 #endif
 			}
 		| CPUSPEED real_expression
@@ -627,6 +665,16 @@ line:		CHARSET '{' charset_flags '}' {}
 		    config.dpmi_base = $2;
 		    c_printf("CONF: DPMI base addr = %#x\n", $2);
 		    }
+		| HUGE_PAGES bool
+		    {
+		    config.huge_pages = ($2!=0);
+		    c_printf("CONF: huge pages for DPMI memory %s\n", ($2) ? "on" : "off");
+		    }
+		| DPMI_LAZY_COMMIT bool
+		    {
+		    config.dpmi_lazy_commit = ($2!=0);
+		    c_printf("CONF: DPMI lazy commit %s\n", ($2) ? "on" : "off");
+		    }
 		| PM_DOS_API bool
 		    {
 		    config.pm_dos_api = ($2!=0);
@@ -980,9 +980,12 @@ int mcommit(void *ptr, size_t size)
   if (err == -1)
     return 0;
 #if HAVE_DECL_MADV_POPULATE_WRITE
-  err = madvise(ptr, size, MADV_POPULATE_WRITE);
-  if (err)
-    perror("madvise()");
+  /* with lazy commit the pages are zero-filled on first access */
+  if (!config.dpmi_lazy_commit) {
+    err = madvise(ptr, size, MADV_POPULATE_WRITE);
+    if (err)
+      perror("madvise()");
+  }
 #endif
   return 1;
 }
@@ -993,6 +996,8 @@ int muncommit(void *ptr, size_t size)
   int cap = MAPPING_INIT_LOWRAM;
   if (mprotect_mapping(cap, targ, size, PROT_NONE) == -1)
     return 0;
+  if (config.dpmi_lazy_commit)
+    madvise(ptr, size, MADV_DONTNEED);
   return 1;
 }
 
@@ -153,6 +153,52 @@ static int sm_commit_simple(struct mempool *mp, void *addr, size_t size)
   return sm_commit(mp, addr, size, NULL, 0);
 }
 
+/* clear the just committed memory */
+static void sm_clear(struct mempool *mp, unsigned char *addr, size_t size)
+{
+  uintptr_t a = (uintptr_t)addr;
+  uintptr_t e = a + size;
+  uintptr_t pa = PAGE_ALIGN(a);
+  uintptr_t pe = e & _PAGE_MASK;
+
+  if (!mp->zero_commit || pa >= pe) {
+    memset(addr, 0, size);
+    return;
+  }
+  /* Whole free pages are uncommitted and come back zero-filled.
+   * Only the pages shared with the neighbours can have stale data. */
+  memset(addr, 0, pa - a);
+  memset((void *)pe, 0, e - pe);
+}
+
+/* sm_uncommit() only releases the pages entirely inside the freed range.
+ * The edge pages may now be entirely free too, in which case they are
+ * released as well so that no whole free page stays committed. */
+static void sm_release_edges(struct mempool *mp, struct memnode *fmn,
+	unsigned char *addr, size_t size)
+{
+  uintptr_t fs, fe, s, e, pg[2];
+  int i;
+
+  if (!mp->zero_commit || !mp->uncommit || !fmn || fmn->used)
+    return;
+  fs = (uintptr_t)fmn->mem_area;
+  fe = fs + fmn->size;
+  s = (uintptr_t)addr;
+  e = s + size;
+  pg[0] = s & _PAGE_MASK;
+  pg[1] = (e - 1) & _PAGE_MASK;
+  for (i = 0; i < 2; i++) {
+    if (i && pg[1] == pg[0])
+      break;
+    if (pg[i] >= s && pg[i] + PAGE_SIZE <= e)
+      continue;  // already released
+    if (pg[i] < fs || pg[i] + PAGE_SIZE > fe)
+      continue;  // still used
+    mp->uncommit((void *)pg[i], PAGE_SIZE);
+  }
+}
+
 static void mntruncate(struct memnode *pmn, size_t size)
 {
   int delta = pmn->size - size;
@@ -278,7 +324,7 @@ static struct memnode *sm_alloc_fixed(struct mempool *mp, void *ptr,
   mn->used = 1;
   mntruncate(mn, size);
   assert(mn->size == size);
-  memset(mn->mem_area, 0, size);
+  sm_clear(mp, mn->mem_area, size);
   return mn;
 }
 
@@ -313,7 +359,7 @@ static struct memnode *sm_alloc_aligned(struct mempool *mp, size_t align,
   mn->used = 1;
   mntruncate(mn, size);
   assert(mn->size == size);
-  memset(mn->mem_area, 0, size);
+  sm_clear(mp, mn->mem_area, size);
   return mn;
 }
 
@@ -363,7 +409,7 @@ static struct memnode *sm_alloc_aligned_topdown(struct mempool *mp,
   mn->used = 1;
   mntruncate(mn, size);
   assert(mn->size == size);
-  memset(mn->mem_area, 0, size);
+  sm_clear(mp, mn->mem_area, size);
   return mn;
 }
 
@@ -419,6 +465,8 @@ void *smalloc_aligned_topdown(struct mempool *mp, unsigned char *top,
 int smfree(struct mempool *mp, void *ptr)
 {
   struct memnode *mn, *pmn;
+  unsigned char *addr;
+  size_t size;
   if (!ptr)
     return -1;
   if (!(mn = find_mn(mp, (unsigned char *)ptr, &pmn))) {
@@ -432,6 +480,8 @@ int smfree(struct mempool *mp, void *ptr)
   assert(mn->size > 0);
   sm_uncommit(mp, mn->mem_area, mn->size);
   mn->used = 0;
+  addr = mn->mem_area;
+  size = mn->size;
   if (mn->next && !mn->next->used) {
     /* merge with next */
     assert(mn->next->mem_area >= mn->mem_area);
@@ -443,6 +493,7 @@ int smfree(struct mempool *mp, void *ptr)
     mntruncate(pmn, pmn->size + mn->size);
     mn = pmn;
   }
+  sm_release_edges(mp, mn, addr, size);
   return 0;
 }
 
@@ -457,6 +508,8 @@ static struct memnode *sm_realloc_alloc_mn(struct mempool *mp,
 	(nmn->used ? 0 : nmn->size) >= size) {
     /* move to prev memnode */
     size_t psize = _min(size, pmn->size);
+    unsigned char *f_addr = NULL;
+    size_t f_size = 0;
     if (!sm_commit_simple(mp, pmn->mem_area, psize))
       return NULL;
     if (size > pmn->size + mn->size) {
@@ -470,11 +523,15 @@ static struct memnode *sm_realloc_alloc_mn(struct mempool *mp,
     mn->used = 0;
     if (size < pmn->size + mn->size) {
       size_t overl = size > pmn->size ? size - pmn->size : 0;
-      sm_uncommit(mp, mn->mem_area + overl, mn->size - overl);
+      f_addr = mn->mem_area + overl;
+      f_size = mn->size - overl;
+      sm_uncommit(mp, f_addr, f_size);
     }
     if (!nmn->used)	// merge with next
       mntruncate(mn, mn->size + nmn->size);
     mntruncate(pmn, size);
+    if (f_size)
+      sm_release_edges(mp, pmn->next, f_addr, f_size);
     new_mn = pmn;
   } else {
     /* relocate */
@@ -511,8 +568,10 @@ void *smrealloc(struct mempool *mp, void *ptr, size_t size)
     return ptr;
   if (size < mn->size) {
     /* shrink */
+    size_t old_size = mn->size;
     sm_uncommit(mp, mn->mem_area + size, mn->size - size);
     mntruncate(mn, size);
+    sm_release_edges(mp, mn->next, mn->mem_area + size, old_size - size);
   } else {
     /* grow */
     struct memnode *nmn = mn->next;
@@ -520,7 +579,7 @@ void *smrealloc(struct mempool *mp, void *ptr, size_t size)
       /* expand by shrinking next memnode */
       if (!sm_commit_simple(mp, nmn->mem_area, size - mn->size))
         return NULL;
-      memset(nmn->mem_area, 0, size - mn->size);
+      sm_clear(mp, nmn->mem_area, size - mn->size);
       mntruncate(mn, size);
     } else {
       /* need to allocate new memnode */
@@ -559,8 +618,10 @@ void *smrealloc_aligned(struct mempool *mp, void *ptr, int align, size_t size)
   }
   if (size < mn->size) {
     /* shrink */
+    size_t old_size = mn->size;
     sm_uncommit(mp, mn->mem_area + size, mn->size - size);
     mntruncate(mn, size);
+    sm_release_edges(mp, mn->next, mn->mem_area + size, old_size - size);
   } else {
     /* grow */
     struct memnode *nmn = mn->next;
@@ -568,7 +629,7 @@ void *smrealloc_aligned(struct mempool *mp, void *ptr, int align, size_t size)
       /* expand by shrinking next memnode */
       if (!sm_commit_simple(mp, nmn->mem_area, size - mn->size))
         return NULL;
-      memset(nmn->mem_area, 0, size - mn->size);
+      sm_clear(mp, nmn->mem_area, size - mn->size);
       mntruncate(mn, size);
     } else {
       /* lazy impl */
@@ -593,6 +654,7 @@ int sminit(struct mempool *mp, void *start, size_t size)
   mp->avail = size;
   mp->commit = NULL;
   mp->uncommit = NULL;
+  mp->zero_commit = 0;
   mp->smerr = smerr;
   return 0;
 }
@@ -677,6 +739,12 @@ void *smget_base_addr(struct mempool *mp)
   return mp->mn.mem_area;
 }
 
+/* the memory reads as zeroes when committed after being uncommitted */
+void smset_zero_commit(struct mempool *mp, int on)
+{
+  mp->zero_commit = on;
+}
+
 void smregister_error_notifier(struct mempool *mp,
 	void (*func)(int prio, const char *fmt, ...) FORMAT(printf, 2, 3))
 {
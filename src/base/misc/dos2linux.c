@@ -544,6 +544,22 @@ static inline void set_unprotected_page(dosaddr_t addr, void *uaddr)
   unprotected_page_unixaddr_tlb[hash] = (void *)((uintptr_t)uaddr & _PAGE_MASK);
 }
 
+/* the same for users outside of this file, e.g. the JIT write helpers */
+void *dosaddr_to_unixaddr_unprotected(dosaddr_t addr, int len)
+{
+  return unprotected_dosaddr_to_unixaddr(addr, len);
+}
+
+/* add a page the caller knows to be plain RAM (not VGA memory etc)
+   to the cache, if it is writable */
+void cache_unprotected_page(dosaddr_t addr)
+{
+  if (addr >= LOWMEM_SIZE + HMASIZE && !dpmi_write_access(addr))
+    return;
+  if (!e_querymprot(addr) && !memcheck_is_rom(addr))
+    set_unprotected_page(addr, dosaddr_to_unixaddr(addr));
+}
+
 void default_sim_pagefault_handler(dosaddr_t addr, int err, uint32_t op, int len)
 {
   if (err & 2)
@@ -850,29 +866,54 @@ int unix_read(int fd, void *data, int cnt)
   return RPT_SYSCALL(read(fd, data, cnt));
 }
 
-int dos_read(int fd, unsigned data, int cnt)
+/* offs -1 is the current file position */
+static int unix_pread(int fd, void *data, int cnt, off_t offs)
+{
+  if (offs == -1)
+    return unix_read(fd, data, cnt);
+  return RPT_SYSCALL(pread(fd, data, cnt, offs));
+}
+
+static int do_dos_read(int fd, unsigned data, int cnt, off_t offs)
 {
   int ret;
   /* GW also reads or writes directly from a file to protected video memory. */
   if (vga.inst_emu && data >= 0xa0000 && data < 0xc0000) {
     char buf[cnt];
-    ret = unix_read(fd, buf, cnt);
+    ret = unix_pread(fd, buf, cnt, offs);
     if (ret >= 0)
       memcpy_to_vga(data, buf, ret);
   }
   else
-    ret = unix_read(fd, LINEAR2UNIX(data), cnt);
+    ret = unix_pread(fd, LINEAR2UNIX(data), cnt, offs);
   if (ret > 0)
 	e_invalidate(data, ret);
   return (ret);
 }
 
+int dos_read(int fd, unsigned data, int cnt)
+{
+  return do_dos_read(fd, data, cnt, -1);
+}
+
+int dos_pread(int fd, unsigned data, int cnt, off_t offs)
+{
+  return do_dos_read(fd, data, cnt, offs);
+}
+
 int unix_write(int fd, const void *data, int cnt)
 {
   return RPT_SYSCALL(write(fd, data, cnt));
 }
 
-int dos_write(int fd, unsigned data, int cnt)
+static int unix_pwrite(int fd, const void *data, int cnt, off_t offs)
+{
+  if (offs == -1)
+    return unix_write(fd, data, cnt);
+  return RPT_SYSCALL(pwrite(fd, data, cnt, offs));
+}
+
+static int do_dos_write(int fd, unsigned data, int cnt, off_t offs)
 {
   int ret;
   const unsigned char *d;
@@ -887,11 +928,21 @@ int dos_write(int fd, unsigned data, int cnt)
   } else {
     d = LINEAR2UNIX(data);
   }
-  ret = unix_write(fd, d, cnt);
+  ret = unix_pwrite(fd, d, cnt, offs);
   g_printf("Wrote %10.10s\n", d);
   return (ret);
 }
 
+int dos_write(int fd, unsigned data, int cnt)
+{
+  return do_dos_write(fd, data, cnt, -1);
+}
+
+int dos_pwrite(int fd, unsigned data, int cnt, off_t offs)
+{
+  return do_dos_write(fd, data, cnt, offs);
+}
+
 #define BUF_SIZE 1024
 int com_vsnprintf(char *str, size_t msize, const char *format, va_list ap)
 {
@@ -36,6 +36,7 @@ struct co_pm {
     Bit16u hlt_off;
     unsigned offs;
     void (*post)(cpuctx_t *);
+    int (*fast)(cpuctx_t *, int);
     int leader:1;
 };
 
@@ -109,6 +110,9 @@ static void coopth_auto_hlt_pm(Bit16u offs, void *sc, void *arg)
     assert(tid >= 0 && tid < MAX_COOPTHREADS);
     switch (offs & 1) {
     case 0:
+	/* fast handler may redirect cs:eip itself, then no thread needed */
+	if (thr->fast && thr->fast(scp, offs >> 1))
+	    break;
 	do_start_custom(tid, scp);
 	break;
     case 1: {
@@ -183,3 +187,11 @@ int coopth_create_pm_multi(const char *name, coopth_func_t func,
     *hlt_off = ret + offs;
     return num;
 }
+
+void coopth_set_pm_fast_handler(int tid, int (*fast)(cpuctx_t *, int))
+{
+    struct co_pm *thr = &coopthpm[tid];
+
+    assert(tid >= 0 && tid < MAX_COOPTHREADS && thr->leader);
+    thr->fast = fast;
+}
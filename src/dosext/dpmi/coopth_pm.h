@@ -8,5 +8,6 @@ int coopth_create_pm(const char *name, coopth_func_t func,
 int coopth_create_pm_multi(const char *name, coopth_func_t func,
 	void (*post)(cpuctx_t *), void *hlt_state, unsigned offs,
 	int len, unsigned int *hlt_off, int r_offs[]);
+void coopth_set_pm_fast_handler(int tid, int (*fast)(cpuctx_t *, int));
 
 #endif
@@ -9,6 +9,9 @@
 
 typedef struct dpmi_pm_block_stuct {
   struct   dpmi_pm_block_stuct *next;
+  struct   dpmi_pm_block_stuct *prev;
+  struct   dpmi_pm_block_stuct *hnext;	/* handle hash chain */
+  unsigned int root_id;
   unsigned int handle;
   unsigned int size;
   dosaddr_t base;
@@ -22,15 +25,19 @@ typedef struct dpmi_pm_block_stuct {
   void *shm_lock;
   uint32_t lock_flags;
   int mapped;
+  int indexed;
 } dpmi_pm_block;
 
+/* roots are copied by value (RSP), so blocks refer to them by id */
 typedef struct dpmi_pm_block_root_struc {
   dpmi_pm_block *first_pm_block;
+  unsigned int id;
 } dpmi_pm_block_root;
 
 dpmi_pm_block *lookup_pm_block(dpmi_pm_block_root *root, unsigned long h);
 dpmi_pm_block *lookup_pm_block_by_addr(dpmi_pm_block_root *root,
 	dosaddr_t addr);
+dpmi_pm_block *lookup_any_pm_block_by_addr(dosaddr_t addr);
 dpmi_pm_block *lookup_pm_block_by_shmname(dpmi_pm_block_root *root,
 	const char *shmname);
 int dpmi_alloc_pool(void);
@@ -104,7 +104,23 @@ static struct {
 #define segment_get(x, f) seg_meta[x].f
 #define segment_set(x, y, f) (seg_meta[x].f = (y))
 #define segment_user(x) segment_get(x, user)
-#define segment_set_user(x, y) segment_set(x, y, user)
+/* entries with a user, and the words of seg_used that are full */
+static uint32_t seg_used[MAX_SELECTORS / 32];
+static uint32_t seg_full[MAX_SELECTORS / 32 / 32];
+static void segment_set_user(int x, int y)
+{
+  int w = x >> 5;
+
+  segment_set(x, y, user);
+  if (y)
+    seg_used[w] |= 1U << (x & 31);
+  else
+    seg_used[w] &= ~(1U << (x & 31));
+  if (seg_used[w] == ~0U)
+    seg_full[w >> 5] |= 1U << (w & 31);
+  else
+    seg_full[w >> 5] &= ~(1U << (w & 31));
+}
 static int in_dpmi;/* Set to 1 when running under DPMI */
 static int dpmi_pm;
 static int in_dpmi_irq;
@@ -508,25 +524,6 @@ static void dpmi_set_pm(int pm)
   }
 }
 
-static dpmi_pm_block *lookup_pm_blocks_by_addr(dosaddr_t addr)
-{
-  int i;
-  dpmi_pm_block *blk = lookup_pm_block_by_addr(&host_pm_block_root, addr);
-  if (blk)
-    return blk;
-  for (i = 0; i < RSP_num; i++) {
-    blk = lookup_pm_block_by_addr(&RSP_callbacks[i].pm_block_root, addr);
-    if (blk)
-      return blk;
-  }
-  for (i = 0; i < in_dpmi; i++) {
-    blk = lookup_pm_block_by_addr(&DPMIclient[i].pm_block_root, addr);
-    if (blk)
-      return blk;
-  }
-  return NULL;
-}
-
 int dpmi_is_valid_range(dosaddr_t addr, int len)
 {
   int i;
@@ -536,7 +533,7 @@ int dpmi_is_valid_range(dosaddr_t addr, int len)
     return 1;
   if (!in_dpmi)
     return 0;
-  blk = lookup_pm_blocks_by_addr(addr);
+  blk = lookup_any_pm_block_by_addr(addr);
   if (!blk)
     return 0;
   if (blk->base + blk->size < addr + len)
@@ -550,13 +547,13 @@ int dpmi_is_valid_range(dosaddr_t addr, int len)
 
 int dpmi_read_access(dosaddr_t addr)
 {
-  dpmi_pm_block *blk = lookup_pm_blocks_by_addr(addr);
+  dpmi_pm_block *blk = lookup_any_pm_block_by_addr(addr);
   return blk && (blk->attrs[(addr - blk->base) >> PAGE_SHIFT] & 1);
 }
 
 int dpmi_write_access(dosaddr_t addr)
 {
-  dpmi_pm_block *blk = lookup_pm_blocks_by_addr(addr);
+  dpmi_pm_block *blk = lookup_any_pm_block_by_addr(addr);
   return blk && (blk->attrs[(addr - blk->base) >> PAGE_SHIFT] & 9) == 9;
 }
 
@@ -799,25 +796,47 @@ static unsigned short AllocateDescriptorsAt(unsigned short selector,
   return selector;
 }
 
+/* find the first run of number_of_descriptors free entries at or
+   after ent, skipping full words and full groups of words at once */
+static int find_free_descriptors(int ent, int number_of_descriptors)
+{
+  int run = ent;
+
+  while (ent < MAX_SELECTORS) {
+    int w = ent >> 5, n;
+    uint32_t used;
+
+    if (!(ent & 0x3ff) && seg_full[w >> 5] == ~0U) {
+      ent += 0x400;
+      run = ent;
+      continue;
+    }
+    used = seg_used[w] >> (ent & 31);
+    if (used & 1) {
+      /* skip the used entries */
+      ent += ~used ? find_bit(~used) : 32;
+      run = ent;
+      continue;
+    }
+    n = used ? find_bit(used) : 32 - (ent & 31);
+    if (ent + n - run >= number_of_descriptors)
+      return run;
+    ent += n;
+  }
+  return -1;
+}
+
 static unsigned short allocate_descriptors_from(int first_ldt, int number_of_descriptors)
 {
-  int next_ldt=first_ldt, i;
+  int next_ldt;
   unsigned short selector;
-  unsigned char used = 1;
-#if 0
-  if (number_of_descriptors > MAX_SELECTORS - 0x100)
-    number_of_descriptors = MAX_SELECTORS - 0x100;
-#endif
-  while (used) {
-    next_ldt++;
-    if (next_ldt > MAX_SELECTORS-number_of_descriptors) {
-      D_printf("DPMI: Insufficient descriptors, requested %i\n",
-        number_of_descriptors);
-      return 0;
-    }
-    used = 0;
-    for (i = 0; i < number_of_descriptors; i++)
-      used |= segment_user(next_ldt+i) || SystemSelector(((next_ldt+i)<<3)|7);
+
+  /* free entries have no user, so they can not be system selectors */
+  next_ldt = find_free_descriptors(first_ldt + 1, number_of_descriptors);
+  if (next_ldt == -1) {
+    D_printf("DPMI: Insufficient descriptors, requested %i\n",
+      number_of_descriptors);
+    return 0;
   }
   selector = (next_ldt<<3) | 0x0007;
   if (allocate_descriptors_at(selector, number_of_descriptors) !=
@@ -3942,6 +3961,8 @@ void dpmi_setup(void)
 
     get_ldt(ldt_buffer, LDT_ENTRIES * LDT_ENTRY_SIZE);
     memset(seg_meta, 0, sizeof(seg_meta));
+    memset(seg_used, 0, sizeof(seg_used));
+    memset(seg_full, 0, sizeof(seg_full));
     for (i = 0; i < MAX_SELECTORS; i++) {
       lp = (unsigned int *)&ldt_buffer[i * LDT_ENTRY_SIZE];
       base_addr = (*lp >> 16) & 0x0000FFFF;
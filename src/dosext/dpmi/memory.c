@@ -55,8 +55,84 @@ static const int dpmi_reserved_space = 4 * 1024 * 1024; // reserve 4Mb
 
 /* utility routines */
 
-/* I don\'t think these function will ever become bottleneck, so just */
-/* keep it simple, --dong */
+/* Blocks of all roots are indexed together: by handle in a hash
+ * table, and the mapped ones by base address in a sorted array.
+ * Blocks do not overlap, except for the hwram mappings of the same
+ * region, which are identical. */
+#define PM_HASH_SIZE 256
+static dpmi_pm_block *pm_handle_hash[PM_HASH_SIZE];
+static dpmi_pm_block **pm_addr_index;
+static int pm_addr_count, pm_addr_max;
+static unsigned int pm_root_ids;
+
+/* returns the position of the last block with base <= addr, or -1 */
+static int addr_index_find(dosaddr_t addr)
+{
+    int lo = 0, hi = pm_addr_count;
+    while (lo < hi) {
+	int mid = (lo + hi) / 2;
+	if (pm_addr_index[mid]->base <= addr)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo - 1;
+}
+
+static void addr_index_insert(dpmi_pm_block *p)
+{
+    int i;
+    if (pm_addr_count == pm_addr_max) {
+	int max = pm_addr_max ? pm_addr_max * 2 : 64;
+	dpmi_pm_block **n = realloc(pm_addr_index, max * sizeof(*n));
+	assert(n);
+	pm_addr_index = n;
+	pm_addr_max = max;
+    }
+    i = addr_index_find(p->base) + 1;
+    memmove(&pm_addr_index[i + 1], &pm_addr_index[i],
+	    (pm_addr_count - i) * sizeof(*pm_addr_index));
+    pm_addr_index[i] = p;
+    pm_addr_count++;
+}
+
+static void addr_index_remove(dpmi_pm_block *p)
+{
+    int i;
+    for (i = addr_index_find(p->base); i >= 0; i--)
+	if (pm_addr_index[i] == p)
+	    break;
+    assert(i >= 0);
+    pm_addr_count--;
+    memmove(&pm_addr_index[i], &pm_addr_index[i + 1],
+	    (pm_addr_count - i) * sizeof(*pm_addr_index));
+}
+
+/* index_pm_block: make a block visible to lookups once its handle,
+ * base and size are set */
+static void index_pm_block(dpmi_pm_block *p)
+{
+    dpmi_pm_block **h = &pm_handle_hash[p->handle % PM_HASH_SIZE];
+    p->hnext = *h;
+    *h = p;
+    if (p->mapped)
+	addr_index_insert(p);
+    p->indexed = 1;
+}
+
+static void unindex_pm_block(dpmi_pm_block *p)
+{
+    dpmi_pm_block **h = &pm_handle_hash[p->handle % PM_HASH_SIZE];
+    if (!p->indexed)
+	return;
+    while (*h != p)
+	h = &(*h)->hnext;
+    *h = p->hnext;
+    if (p->mapped)
+	addr_index_remove(p);
+    p->indexed = 0;
+}
+
 /* alloc_pm_block: allocate a dpmi_pm_block struct and add it to the list */
 static dpmi_pm_block * alloc_pm_block(dpmi_pm_block_root *root, unsigned long size)
 {
@@ -69,7 +145,12 @@ static dpmi_pm_block * alloc_pm_block(dpmi_pm_block_root *root, unsigned long si
 	free(p);
 	return NULL;
     }
+    if (!root->id)
+	root->id = ++pm_root_ids;
+    p->root_id = root->id;
     p->next = root->first_pm_block;	/* add it to list */
+    if (p->next)
+	p->next->prev = p;
     root->first_pm_block = p;
     p->mapped = 1;
     return p;
@@ -87,24 +168,18 @@ static void * realloc_pm_block(dpmi_pm_block *block, unsigned long newsize)
 /* free_pm_block free a dpmi_pm_block struct and delete it from list */
 static int free_pm_block(dpmi_pm_block_root *root, dpmi_pm_block *p)
 {
-    dpmi_pm_block *tmp = NULL;
-    dpmi_pm_block *next;
-    if (!p) return -1;
-    if (p != root->first_pm_block) {
-	for(tmp = root->first_pm_block; tmp; tmp = tmp->next)
-	    if (tmp -> next == p)
-		break;
-	if (!tmp) return -1;
-    }
-    next = p->next;
+    if (!p || p->root_id != root->id) return -1;
+    unindex_pm_block(p);
+    if (p->prev)
+	p->prev->next = p->next;
+    else
+	root->first_pm_block = p->next;
+    if (p->next)
+	p->next->prev = p->prev;
     free(p->attrs);
     free(p->shmname);
     free(p->rshmname);
     free(p);
-    if (tmp)
-	tmp->next = next;
-    else
-	root->first_pm_block = next;
     return 0;
 }
 
@@ -112,17 +187,34 @@ static int free_pm_block(dpmi_pm_block_root *root, dpmi_pm_block *p)
 dpmi_pm_block *lookup_pm_block(dpmi_pm_block_root *root, unsigned long h)
 {
     dpmi_pm_block *tmp;
-    for(tmp = root->first_pm_block; tmp; tmp = tmp->next) {
-	if (tmp -> handle == h)
+    for (tmp = pm_handle_hash[h % PM_HASH_SIZE]; tmp; tmp = tmp->hnext) {
+	if (tmp->handle == h && tmp->root_id == root->id)
 	    return tmp;
     }
     return NULL;
 }
 
+/* lookup_any_pm_block_by_addr returns the mapped block of any client
+ * containing addr */
+dpmi_pm_block *lookup_any_pm_block_by_addr(dosaddr_t addr)
+{
+    dpmi_pm_block *tmp;
+    int i = addr_index_find(addr);
+    if (i < 0)
+	return NULL;
+    tmp = pm_addr_index[i];
+    if (addr >= tmp->base + tmp->size)
+	return NULL;
+    return tmp;
+}
+
 dpmi_pm_block *lookup_pm_block_by_addr(dpmi_pm_block_root *root,
 	dosaddr_t addr)
 {
-    dpmi_pm_block *tmp;
+    dpmi_pm_block *tmp = lookup_any_pm_block_by_addr(addr);
+    if (tmp && tmp->root_id == root->id)
+	return tmp;
+    /* hwram mapped by several clients */
     for(tmp = root->first_pm_block; tmp; tmp = tmp->next) {
 	if (tmp->mapped && addr >= tmp->base && addr < tmp->base + tmp->size)
 	    return tmp;
@@ -150,9 +242,11 @@ static int commit(void *ptr, size_t size)
 	PROT_READ | PROT_WRITE | PROT_EXEC) == -1)
     return 0;
 #if HAVE_DECL_MADV_POPULATE_WRITE
-  err = madvise(ptr, size, MADV_POPULATE_WRITE);
-  if (err)
-    perror("madvise()");
+  if (!config.dpmi_lazy_commit) {
+    err = madvise(ptr, size, MADV_POPULATE_WRITE);
+    if (err)
+      perror("madvise()");
+  }
 #endif
   return 1;
 }
@@ -161,6 +255,9 @@ static int uncommit(void *ptr, size_t size)
 {
   if (mprotect_mapping(MAPPING_DPMI, DOSADDR_REL(ptr), size, PROT_NONE) == -1)
     return 0;
+  /* give the pages back, they are zero-filled again when recommitted */
+  if (config.dpmi_lazy_commit)
+    madvise(ptr, size, MADV_DONTNEED);
   return 1;
 }
 
@@ -215,6 +312,7 @@ int dpmi_alloc_pool(void)
     c_printf("DPMI: mem init, mpool is %d bytes at %p\n", memsize, dpmi_base);
     /* Create DPMI pool */
     sminit_com(&mem_pool, dpmi_base, memsize, commit, uncommit);
+    smset_zero_commit(&mem_pool, config.dpmi_lazy_commit);
     dpmi_total_memory = config.dpmi * 1024;
 
     D_printf("DPMI: dpmi_free_memory available 0x%x\n", dpmi_total_memory);
@@ -228,7 +326,11 @@ void dpmi_free_pool(void)
 	error("DPMI: leaked %i bytes (main pool)\n", leak);
 }
 
-static int SetAttribsForPage(unsigned int ptr, uint16_t attr, uint16_t *old_attr_p)
+/* SetAttribsForPage: update the attributes of a page. The protection
+ * to apply is returned in *prot_p, or -1 if it does not change; the
+ * caller applies it to runs of pages at once. */
+static int SetAttribsForPage(unsigned int ptr, uint16_t attr, uint16_t *old_attr_p,
+    int *prot_p)
 {
     uint16_t old_attr = *old_attr_p;
     int prot, change = 0, com = attr & 3, old_com = old_attr & 1;
@@ -338,44 +440,72 @@ static int SetAttribsForPage(unsigned int ptr, uint16_t attr, uint16_t *old_attr
 
     D_printf("Addr=%#x\n", ptr);
 
-    if (change) {
-      e_invalidate_full(ptr, PAGE_SIZE);
-      if (com) {
-        if (mprotect_mapping(MAPPING_DPMI, ptr, PAGE_SIZE, prot) == -1) {
-          leavedos(2);
-          return 0;
-        }
-      } else {
-        if (mprotect_mapping(MAPPING_DPMI, ptr, PAGE_SIZE, PROT_NONE) == -1) {
-          D_printf("mmap() failed: %s\n", strerror(errno));
-          return 0;
-        }
+    *prot_p = -1;
+    if (change)
+      *prot_p = com ? prot : PROT_NONE;
+
+    return 1;
+}
+
+static int ProtectPages(dosaddr_t ptr, int pages, int prot)
+{
+    size_t size = (size_t)pages << PAGE_SHIFT;
+
+    if (!pages)
+      return 1;
+    e_invalidate_full(ptr, size);
+    if (prot != PROT_NONE) {
+      if (mprotect_mapping(MAPPING_DPMI, ptr, size, prot) == -1) {
+        leavedos(2);
+        return 0;
+      }
+    } else {
+      if (mprotect_mapping(MAPPING_DPMI, ptr, size, PROT_NONE) == -1) {
+        D_printf("mmap() failed: %s\n", strerror(errno));
+        return 0;
       }
     }
-
     return 1;
 }
 
 static int SetPageAttributes(dpmi_pm_block *block, int offs, uint16_t attrs[], int count)
 {
   u_short *attr;
-  int i;
+  int i, prot;
+  /* run of adjacent pages getting the same protection */
+  dosaddr_t run_start = 0;
+  int run_pages = 0, run_prot = -1;
 
   for (i = 0; i < count; i++) {
+    dosaddr_t ptr = block->base + offs + (i << PAGE_SHIFT);
     attr = block->attrs + (offs >> PAGE_SHIFT) + i;
     if (*attr == attrs[i]) {
       continue;
     }
     if ((*attr & ATTR_SHR) && ((attrs[i] & 7) != 3)) {
       D_printf("Disallow change type of shared page\n");
+      ProtectPages(run_start, run_pages, run_prot);
       return 0;
     }
     D_printf("%i\t", i);
-    if (!SetAttribsForPage(block->base + offs + (i << PAGE_SHIFT),
-	attrs[i], attr))
+    if (!SetAttribsForPage(ptr, attrs[i], attr, &prot)) {
+      ProtectPages(run_start, run_pages, run_prot);
       return 0;
+    }
+    if (prot == -1)
+      continue;
+    if (run_pages && prot == run_prot &&
+        ptr == run_start + (run_pages << PAGE_SHIFT)) {
+      run_pages++;
+      continue;
+    }
+    if (!ProtectPages(run_start, run_pages, run_prot))
+      return 0;
+    run_start = ptr;
+    run_pages = 1;
+    run_prot = prot;
   }
-  return 1;
+  return ProtectPages(run_start, run_pages, run_prot);
 }
 
 static void restore_page_protection(dpmi_pm_block *block)
@@ -413,6 +543,7 @@ dpmi_pm_block * DPMI_malloc(dpmi_pm_block_root *root, unsigned int size)
     mem_allocd += size;
     block->handle = pm_block_handle_used++;
     block->size = size;
+    index_pm_block(block);
     return block;
 }
 
@@ -468,6 +599,7 @@ dpmi_pm_block * DPMI_mallocLinear(dpmi_pm_block_root *root,
 	mem_allocd += size;
     block->handle = pm_block_handle_used++;
     block->size = size;
+    index_pm_block(block);
     return block;
 }
 
@@ -490,6 +622,7 @@ dpmi_pm_block * DPMI_mapHWRam(dpmi_pm_block_root *root,
 	block->attrs[i] = 9;
     block->handle = pm_block_handle_used++;
     block->size = size;
+    index_pm_block(block);
     return block;
 }
 
@@ -505,6 +638,8 @@ static void do_unmap_shm(dpmi_pm_block *block)
     if (err)
         error("restore_mapping() failed\n");
     smfree(&mem_pool, MEM_BASE32(block->base));
+    if (block->indexed)
+	addr_index_remove(block);
     block->mapped = 0;
 }
 
@@ -657,6 +792,7 @@ dpmi_pm_block *DPMI_mallocShared(dpmi_pm_block_root *root,
     ptr->shm = 1;
     ptr->linear = 1;
     ptr->handle = pm_block_handle_used++;
+    index_pm_block(ptr);
     ptr->shmname = strdup(name);
     ptr->rshmname = shmname;
     ptr->shlock = shlock;
@@ -787,8 +923,12 @@ dpmi_pm_block * DPMI_realloc(dpmi_pm_block_root *root,
 	return NULL;
 
     finish_realloc(block, newsize, 1);
+    if (block->mapped)
+	addr_index_remove(block);
     block->base = DOSADDR_REL(ptr);
     block->size = newsize;
+    if (block->mapped)
+	addr_index_insert(block);
     restore_page_protection(block);
     return block;
 }
@@ -833,8 +973,12 @@ dpmi_pm_block * DPMI_reallocLinear(dpmi_pm_block_root *root,
     }
 
     finish_realloc(block, newsize, committed);
+    if (block->mapped)
+	addr_index_remove(block);
     block->base = DOSADDR_REL(ptr);
     block->size = newsize;
+    if (block->mapped)
+	addr_index_insert(block);
     /* restore_page_protection() will set proper prots */
     mprotect_mapping(MAPPING_DPMI, block->base, block->size,
 		PROT_READ | PROT_WRITE | PROT_EXEC);
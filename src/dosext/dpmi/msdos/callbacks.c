@@ -201,6 +201,15 @@ struct pmrm_ret msdos_ext_call(cpuctx_t *scp,
     return ret;
 }
 
+int msdos_ext_fast(cpuctx_t *scp, void *(*arg)(int), int off,
+	DPMI_INTDESC *prev)
+{
+    if (!msdos_pre_passthrough(scp, msdos_get_int_num(off)))
+	return 0;
+    *prev = *(const DPMI_INTDESC *)arg(off);
+    return 1;
+}
+
 struct pext_ret msdos_ext_ret(cpuctx_t *scp,
 	const struct RealModeCallStructure *rmreg,
 	unsigned short rm_seg, int off)
@@ -9,6 +9,8 @@ void msdos_api_winos2_call(cpuctx_t *scp, void *arg);
 struct pmrm_ret msdos_ext_call(cpuctx_t *scp,
 	struct RealModeCallStructure *rmreg,
 	unsigned short rm_seg, void *(*arg)(int), int off);
+int msdos_ext_fast(cpuctx_t *scp, void *(*arg)(int), int off,
+	DPMI_INTDESC *prev);
 struct pext_ret msdos_ext_ret(cpuctx_t *scp,
 	const struct RealModeCallStructure *rmreg,
 	unsigned short rm_seg, int off);
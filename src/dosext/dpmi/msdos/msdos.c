@@ -237,7 +237,7 @@ static void setup_int_exc(int inherit_idt)
 	int int_offs[num_ints];
 
 	pma = get_pmrm_handler_m(MSDOS_EXT_CALL, msdos_ext_call,
-	    get_prev_ext, msdos_ext_ret, get_xbuf_seg, NULL,
+	    msdos_ext_fast, get_prev_ext, msdos_ext_ret, get_xbuf_seg, NULL,
 	    num_ints, int_offs);
 	desc.selector = pma.selector;
 	desc.offset32 = pma.offset;
@@ -982,6 +982,97 @@ static int do_abs_rw(cpuctx_t *scp, struct RealModeCallStructure *rmreg,
     return 0;
 }
 
+/* Returns 1 if msdos_pre_extender() has something to do for the call.
+ * Otherwise it returns MSDOS_NONE without touching anything, and the
+ * call can also be chained to the previous handler directly. */
+static int pre_extender_needed(cpuctx_t *scp, int intr)
+{
+    if (MSDOS_CLIENT.user_dta_sel && intr == 0x21) {
+	switch (_HI(ax)) {	/* functions use DTA */
+	case 0x11:
+	case 0x12:		/* find first/next using FCB */
+	case 0x4e:
+	case 0x4f:		/* find first/next */
+	    return 1;
+	}
+    }
+    if (need_xbuf(intr, _LWORD(eax), _LWORD(ecx)))
+	return 1;
+
+    switch (intr) {
+    case 0x41:			/* win debug */
+    case 0x20:			/* DOS terminate */
+    case 0x25:			/* Absolute Disk Read */
+    case 0x26:			/* Absolute Disk Write */
+    case 0x28:
+	return 1;
+    case 0x10:
+	return (_LWORD(eax) == 0x1130);
+    case 0x15:			/* misc */
+	return (_HI(ax) == 0xc0 || _HI(ax) == 0xc2);
+    case 0x21:
+	switch (_HI(ax)) {
+	case 0x00:
+	case 0x09:
+	case 0x0f ... 0x17:
+	case 0x1a:
+	case 0x21 ... 0x29:
+	case 0x2f:
+	case 0x32:
+	case 0x34 ... 0x35:
+	case 0x38 ... 0x3d:
+	case 0x3f ... 0x41:
+	case 0x43:
+	case 0x47 ... 0x4b:
+	case 0x4e:
+	case 0x50 ... 0x53:
+	case 0x55 ... 0x56:
+	case 0x59:
+	case 0x5b:
+	case 0x5d:
+	case 0x5f ... 0x60:
+	case 0x62 ... 0x63:
+	case 0x65:
+	case 0x6c:
+	case 0x71:
+	case 0x73:
+	    return 1;
+	}
+	return 0;
+    case 0x2f:
+	switch (_LWORD(eax)) {
+	case 0x1680:
+	case 0x1687:
+	case 0x1688:
+	case 0x168a:
+	case 0x4310:
+	case 0xae00:
+	case 0xae01:
+	    return 1;
+	}
+	return 0;
+    case 0x33:			/* mouse */
+	switch (_LWORD(eax)) {
+	case 0x09:
+	case 0x0c:
+	case 0x14:
+	case 0x19:
+	    return 1;
+	}
+	return 0;
+#ifdef SUPPORT_DOSEMU_HELPERS
+    case DOS_HELPER_INT:	/* dosemu helpers */
+	return (_LO(ax) == DOS_HELPER_PRINT_STRING);
+#endif
+    }
+    return 0;
+}
+
+int msdos_pre_passthrough(cpuctx_t *scp, int intr)
+{
+    return !pre_extender_needed(scp, intr);
+}
+
 /*
  * DANG_BEGIN_FUNCTION msdos_pre_extender
  *
@@ -998,10 +1089,14 @@ int msdos_pre_extender(cpuctx_t *scp,
 			       int intr, unsigned short rm_seg,
 			       int *r_mask, far_t *r_rma)
 {
-    int rm_mask = *r_mask, alt_ent = 0, act = 0;
+    int rm_mask = *r_mask, alt_ent = 0;
 
     D_printf("MSDOS: pre_extender: int 0x%x, ax=0x%x\n", intr,
 	     _LWORD(eax));
+    /* all the calls handled below are listed there */
+    if (!pre_extender_needed(scp, intr))
+	return MSDOS_NONE;
+
     if (MSDOS_CLIENT.user_dta_sel && intr == 0x21) {
 	switch (_HI(ax)) {	/* functions use DTA */
 	case 0x11:
@@ -1009,14 +1104,10 @@ int msdos_pre_extender(cpuctx_t *scp,
 	case 0x4e:
 	case 0x4f:		/* find first/next */
 	    MEMCPY_2DOS(DTA_under_1MB, DTA_over_1MB, 0x80);
-	    act = 1;
 	    break;
 	}
     }
 
-    if (need_xbuf(intr, _LWORD(eax), _LWORD(ecx)))
-	act = 1;
-
     /* only consider DOS and some BIOS services */
     switch (intr) {
     case 0x41:			/* win debug */
@@ -1028,8 +1119,6 @@ int msdos_pre_extender(cpuctx_t *scp,
 	case 0x1130:
 	    break;
 	default:
-	    if (!act)
-		return MSDOS_NONE;
 	    break;
 	}
 	break;
@@ -1062,8 +1151,6 @@ int msdos_pre_extender(cpuctx_t *scp,
 	    }
 	    break;
 	default:
-	    if (!act)
-		return MSDOS_NONE;
 	    break;
 	}
 	break;
@@ -1624,8 +1711,6 @@ int msdos_pre_extender(cpuctx_t *scp,
 	    break;
 
 	default:
-	    if (!act)
-		return MSDOS_NONE;
 	    break;
 	}
 	break;
@@ -1704,8 +1789,6 @@ int msdos_pre_extender(cpuctx_t *scp,
 	    break;
 	}
 	default:	// for do_int()
-	    if (!act)
-		return MSDOS_NONE;
 	    break;
 	}
 	break;
@@ -1745,8 +1828,6 @@ int msdos_pre_extender(cpuctx_t *scp,
 	    }
 	    break;
 	default:
-	    if (!act)
-		return MSDOS_NONE;
 	    break;
 	}
 	break;
@@ -1765,16 +1846,12 @@ int msdos_pre_extender(cpuctx_t *scp,
 	    }
 	    break;
 	default:
-	    if (!act)
-		return MSDOS_NONE;
 	    break;
 	}
 	break;
 #endif
 
     default:
-	if (!act)
-	    return MSDOS_NONE;
 	break;
     }
 
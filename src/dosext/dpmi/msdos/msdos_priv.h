@@ -13,6 +13,7 @@ int msdos_pre_extender(cpuctx_t *scp,
 			struct RealModeCallStructure *rmreg,
 			int intr, unsigned short rm_seg,
 			int *r_mask, far_t *r_rma);
+int msdos_pre_passthrough(cpuctx_t *scp, int intr);
 int msdos_post_extender(cpuctx_t *scp,
 			const struct RealModeCallStructure *rmreg,
 			int intr, unsigned short rm_seg, int *rmask,
@@ -61,6 +61,8 @@ struct msdos_ops {
     struct pmrm_ret (*ext_call)(cpuctx_t *scp,
 	struct RealModeCallStructure *rmreg, unsigned short rm_seg,
 	void *(*arg)(int), int off);
+    int (*ext_fast)(cpuctx_t *scp, void *(*arg)(int), int off,
+	DPMI_INTDESC *prev);
     void *(*ext_arg)(int);
     struct pext_ret (*ext_ret)(cpuctx_t *scp,
 	const struct RealModeCallStructure *rmreg, unsigned short rm_seg,
@@ -91,6 +93,17 @@ static struct rm_helper_s term_helper;
 
 static void *hlt_state;
 
+#ifdef DOSEMU
+/* PM->RM switch statistics, reported once per second with -D9M */
+struct ext_stats_s {
+    unsigned fast;
+    unsigned thr;
+    unsigned rm;
+    hitimer_t last;
+};
+static struct ext_stats_s ext_stats;
+#endif
+
 static void do_retf(cpuctx_t *scp)
 {
     int is_32 = msdos.is_32();
@@ -416,6 +429,8 @@ struct pmaddr_s get_pmrm_handler_m(enum MsdOpIds id,
 	struct pmrm_ret (*handler)(
 	cpuctx_t *, struct RealModeCallStructure *,
 	unsigned short, void *(*)(int), int),
+	int (*fast_handler)(
+	cpuctx_t *, void *(*)(int), int, DPMI_INTDESC *),
 	void *(*arg)(int),
 	struct pext_ret (*ret_handler)(
 	cpuctx_t *, const struct RealModeCallStructure *,
@@ -429,6 +444,7 @@ struct pmaddr_s get_pmrm_handler_m(enum MsdOpIds id,
     switch (id) {
     case MSDOS_EXT_CALL:
 	msdos.ext_call = handler;
+	msdos.ext_fast = fast_handler;
 	msdos.ext_arg = arg;
 	msdos.ext_ret = ret_handler;
 	h = &ext_helper;
@@ -628,6 +644,38 @@ static void do_post_push(void *arg)
 }
 
 #ifdef DOSEMU
+static void ext_stats_update(void)
+{
+    hitimer_t now;
+
+    if (debug_level('M') < 9)
+	return;
+    now = GETusTIME(0);
+    if (now - ext_stats.last < 1000000)
+	return;
+    if (ext_stats.last)
+	D_printf("MSDOS: ext calls/s: fast %u, thread %u, RM switches %u\n",
+		ext_stats.fast, ext_stats.thr, ext_stats.rm);
+    ext_stats.fast = ext_stats.thr = ext_stats.rm = 0;
+    ext_stats.last = now;
+}
+
+/* Called from hlt handler before the thread is started. Pass-through
+ * calls that need no translation are chained to the previous handler
+ * right away, without the coopth switch and register frame save. */
+static int exthlp_fast(cpuctx_t *scp, int off)
+{
+    DPMI_INTDESC prev;
+
+    if (!msdos.ext_fast || !msdos.ext_fast(scp, msdos.ext_arg, off, &prev))
+	return 0;
+    ext_stats.fast++;
+    ext_stats_update();
+    _cs = prev.selector;
+    _eip = prev.offset32;
+    return 1;
+}
+
 static void exthlp_thr(void *arg)
 {
     cpuctx_t *scp = arg;
@@ -645,6 +693,8 @@ static void exthlp_thr(void *arg)
 	doshlp_quit_dpmi(scp);
 	return;
     }
+    ext_stats.thr++;
+    ext_stats_update();
     ret = msdos.ext_call(scp, &rmreg, rm_seg, msdos.ext_arg, off);
     switch (ret.ret) {
     case MSDOS_NONE:
@@ -654,9 +704,11 @@ static void exthlp_thr(void *arg)
 	_eip = ret.prev.offset32;
 	return;
     case MSDOS_RMINT:
+	ext_stats.rm++;
 	do_int_call(scp, is_32, ret.inum, &rmreg);
 	break;
     case MSDOS_RM:
+	ext_stats.rm++;
 	do_int_to(scp, is_32, ret.faddr, &rmreg);
 	break;
     case MSDOS_DONE:
@@ -686,6 +738,7 @@ void msdoshlp_init(int (*is_32)(void), int len)
 	    DPMI_SEL_OFF(MSDOS_hlt_start));
     doshlp_setup_m(&ext_helper, "msdos ext thr", exthlp_thr, do_dpmi_iret,
 	    len);
+    coopth_set_pm_fast_handler(ext_helper.tid, exthlp_fast);
     exechlp_setup();
     termhlp_setup();
 #endif
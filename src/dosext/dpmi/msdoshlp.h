@@ -39,6 +39,8 @@ struct pmaddr_s get_pmrm_handler_m(enum MsdOpIds id,
 	struct pmrm_ret (*handler)(
 	cpuctx_t *, struct RealModeCallStructure *,
 	unsigned short, void *(*)(int), int),
+	int (*fast_handler)(
+	cpuctx_t *, void *(*)(int), int, DPMI_INTDESC *),
 	void *(*arg)(int),
 	struct pext_ret (*ret_handler)(
 	cpuctx_t *, const struct RealModeCallStructure *,
@@ -0,0 +1,325 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: directory name cache for case-insensitive lookups.
+ *
+ * scan_dir() has to convert every entry of a host directory to the DOS
+ * charset (and possibly mangle it) to find the one matching a DOS name.
+ * For large directories that is done on every open. Here we do the
+ * conversion once per directory and keep the results hashed by the
+ * case-folded DOS name.
+ *
+ * The cache is validated against the directory's mtime/ctime on every
+ * lookup. A directory modified within the timestamp granularity of the
+ * cache build is not cached, as the later change may go unnoticed.
+ * The total size is bounded, least recently used directories are
+ * dropped first.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "emu.h"
+#include "dos2linux.h"
+#include "mangle.h"
+#include "mfs.h"
+#include "dircache.h"
+
+#define DIRCACHE_BUDGET (8 * 1024 * 1024)
+/* directories changed less than that many seconds ago are not cached */
+#define DIRCACHE_RACY_SECS 2
+
+enum { KEY_LFN = 1, KEY_83 = 2, KEY_MANGLED = 4 };
+
+struct dc_key {
+  unsigned hash;
+  int str;
+  int ent;
+  int next;
+  unsigned char mask;
+};
+
+struct dc_ent {
+  int host;
+  int dos;
+};
+
+struct dircache {
+  char *path;
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  struct timespec ctime;
+  char *strs;
+  size_t strs_len;
+  size_t strs_size;
+  struct dc_ent *ents;
+  int nents;
+  int ents_size;
+  struct dc_key *keys;
+  int nkeys;
+  int keys_size;
+  int *buckets;
+  unsigned nbuckets;
+  size_t bytes;
+  struct dircache *prev;
+  struct dircache *next;
+};
+
+/* LRU list, most recently used first */
+static struct dircache *dc_head;
+static struct dircache *dc_tail;
+static size_t dc_bytes;
+
+static unsigned dc_hash(const char *s)
+{
+  unsigned h = 5381;
+
+  while (*s)
+    h = h * 33 + toupperDOS(*s++);
+  return h;
+}
+
+static int dc_add_str(struct dircache *dc, const char *s)
+{
+  size_t len = strlen(s) + 1;
+  int ret;
+
+  if (dc->strs_len + len > dc->strs_size) {
+    dc->strs_size = (dc->strs_size + len) * 2;
+    dc->strs = realloc(dc->strs, dc->strs_size);
+  }
+  ret = dc->strs_len;
+  memcpy(dc->strs + ret, s, len);
+  dc->strs_len += len;
+  return ret;
+}
+
+static void dc_add_key(struct dircache *dc, int str, int ent, int mask)
+{
+  if (dc->nkeys == dc->keys_size) {
+    dc->keys_size = dc->keys_size ? dc->keys_size * 2 : 64;
+    dc->keys = realloc(dc->keys, dc->keys_size * sizeof(dc->keys[0]));
+  }
+  dc->keys[dc->nkeys].hash = dc_hash(dc->strs + str);
+  dc->keys[dc->nkeys].str = str;
+  dc->keys[dc->nkeys].ent = ent;
+  dc->keys[dc->nkeys].mask = mask;
+  dc->nkeys++;
+}
+
+static void dc_add_ent(struct dircache *dc, const struct mfs_dirent *de)
+{
+  char tmpname[NAME_MAX + 1];
+  struct dc_ent *ent;
+  int repr, mask = 0;
+
+  if (dc->nents == dc->ents_size) {
+    dc->ents_size = dc->ents_size ? dc->ents_size * 2 : 64;
+    dc->ents = realloc(dc->ents, dc->ents_size * sizeof(dc->ents[0]));
+  }
+  ent = &dc->ents[dc->nents];
+  ent->host = dc_add_str(dc, de->d_name);
+  repr = name_ufs_to_dos(tmpname, de->d_long_name);
+  ent->dos = dc_add_str(dc, tmpname);
+  if (repr)
+    mask |= KEY_LFN;
+  if (name_convert(tmpname, 0))
+    mask |= KEY_83;
+  else if (MANGLE) {
+    name_mangle_83(tmpname);
+    dc_add_key(dc, dc_add_str(dc, tmpname), dc->nents, KEY_MANGLED);
+  }
+  if (mask)
+    dc_add_key(dc, ent->dos, dc->nents, mask);
+  dc->nents++;
+}
+
+static void dc_hash_keys(struct dircache *dc)
+{
+  int i;
+
+  dc->nbuckets = 64;
+  while (dc->nbuckets < dc->nkeys)
+    dc->nbuckets <<= 1;
+  dc->buckets = malloc(dc->nbuckets * sizeof(dc->buckets[0]));
+  for (i = 0; i < dc->nbuckets; i++)
+    dc->buckets[i] = -1;
+  for (i = 0; i < dc->nkeys; i++) {
+    unsigned b = dc->keys[i].hash & (dc->nbuckets - 1);
+    dc->keys[i].next = dc->buckets[b];
+    dc->buckets[b] = i;
+  }
+  dc->bytes = sizeof(*dc) + strlen(dc->path) + 1 + dc->strs_size +
+      dc->ents_size * sizeof(dc->ents[0]) +
+      dc->keys_size * sizeof(dc->keys[0]) +
+      dc->nbuckets * sizeof(dc->buckets[0]);
+}
+
+static void dc_free(struct dircache *dc)
+{
+  free(dc->path);
+  free(dc->strs);
+  free(dc->ents);
+  free(dc->keys);
+  free(dc->buckets);
+  free(dc);
+}
+
+static void dc_unlink(struct dircache *dc)
+{
+  if (dc->prev)
+    dc->prev->next = dc->next;
+  else
+    dc_head = dc->next;
+  if (dc->next)
+    dc->next->prev = dc->prev;
+  else
+    dc_tail = dc->prev;
+  dc_bytes -= dc->bytes;
+}
+
+static void dc_link_head(struct dircache *dc)
+{
+  dc->prev = NULL;
+  dc->next = dc_head;
+  if (dc_head)
+    dc_head->prev = dc;
+  else
+    dc_tail = dc;
+  dc_head = dc;
+  dc_bytes += dc->bytes;
+}
+
+static void dc_drop(struct dircache *dc)
+{
+  dc_unlink(dc);
+  dc_free(dc);
+}
+
+static int dc_is_valid(const struct dircache *dc, const struct stat *st)
+{
+  return dc->dev == st->st_dev && dc->ino == st->st_ino &&
+      dc->mtime.tv_sec == st->st_mtim.tv_sec &&
+      dc->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+      dc->ctime.tv_sec == st->st_ctim.tv_sec &&
+      dc->ctime.tv_nsec == st->st_ctim.tv_nsec;
+}
+
+static struct dircache *dc_build(const char *path, const struct stat *st)
+{
+  struct dircache *dc;
+  struct mfs_dir *dir;
+  struct mfs_dirent *de;
+
+  dir = dos_opendir(path);
+  if (!dir)
+    return NULL;
+  dc = calloc(1, sizeof(*dc));
+  dc->path = strdup(path);
+  dc->dev = st->st_dev;
+  dc->ino = st->st_ino;
+  dc->mtime = st->st_mtim;
+  dc->ctime = st->st_ctim;
+  while ((de = dos_readdir(dir)))
+    dc_add_ent(dc, de);
+  dos_closedir(dir);
+  dc_hash_keys(dc);
+  Debug0((dbg_fd, "dircache: cached %s, %i entries, %zu bytes\n",
+      path, dc->nents, dc->bytes));
+  return dc;
+}
+
+static struct dircache *dc_get(const char *path)
+{
+  struct dircache *dc;
+  struct stat st;
+
+  if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+    return NULL;
+  for (dc = dc_head; dc; dc = dc->next) {
+    if (strcmp(dc->path, path) != 0)
+      continue;
+    dc_unlink(dc);
+    if (dc_is_valid(dc, &st)) {
+      dc_link_head(dc);
+      return dc;
+    }
+    Debug0((dbg_fd, "dircache: %s changed\n", path));
+    dc_free(dc);
+    break;
+  }
+  if (time(NULL) - st.st_mtim.tv_sec < DIRCACHE_RACY_SECS ||
+      time(NULL) - st.st_ctim.tv_sec < DIRCACHE_RACY_SECS)
+    return NULL;
+  dc = dc_build(path, &st);
+  if (!dc)
+    return NULL;
+  if (dc->bytes > DIRCACHE_BUDGET) {
+    dc_free(dc);
+    return NULL;
+  }
+  while (dc_tail && dc_bytes + dc->bytes > DIRCACHE_BUDGET)
+    dc_drop(dc_tail);
+  dc_link_head(dc);
+  return dc;
+}
+
+int dircache_find(const char *path, char *name, const char *dosname,
+    int is_8_3, int maybe_mangled)
+{
+  struct dircache *dc = dc_get(path);
+  unsigned hash;
+  int i, mask, found = -1, found_mask = 0;
+
+  if (!dc)
+    return -1;
+  mask = is_8_3 ? KEY_83 : KEY_LFN;
+  if (is_8_3 && maybe_mangled)
+    mask |= KEY_MANGLED;
+  hash = dc_hash(dosname);
+  /* scan_dir() returns the first match in readdir order */
+  for (i = dc->buckets[hash & (dc->nbuckets - 1)]; i != -1;
+      i = dc->keys[i].next) {
+    const struct dc_key *k = &dc->keys[i];
+    if (k->hash != hash || !(k->mask & mask) ||
+        (found != -1 && k->ent > found))
+      continue;
+    if (!strequalDOS(dc->strs + k->str, dosname))
+      continue;
+    found = k->ent;
+    found_mask = k->mask;
+  }
+  if (found == -1)
+    return 0;
+  if (found_mask & KEY_MANGLED) {
+    /* record on the mangled stack, as scan_dir() does */
+    char tmpname[NAME_MAX + 1];
+    strcpy(tmpname, dc->strs + dc->ents[found].dos);
+    name_convert(tmpname, MANGLE);
+  }
+  strcpy(name, dc->strs + dc->ents[found].host);
+  Debug0((dbg_fd, "dircache found %s\n", name));
+  return 1;
+}
+
+void dircache_flush(void)
+{
+  while (dc_head)
+    dc_drop(dc_head);
+}
@@ -0,0 +1,8 @@
+#ifndef DIRCACHE_H
+#define DIRCACHE_H
+
+int dircache_find(const char *path, char *name, const char *dosname,
+    int is_8_3, int maybe_mangled);
+void dircache_flush(void);
+
+#endif
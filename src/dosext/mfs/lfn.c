@@ -1187,6 +1187,7 @@ int mfs_lfn(void)
 		return 0;
 	}
 
+	mfs_iobuf_flush_all();
 	carry = isset_CF();
 	ret = mfs_lfn_();
 	/* preserve carry if we forward the LFN request */
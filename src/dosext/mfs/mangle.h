@@ -43,6 +43,7 @@ extern dosaddr_t is_dos_device(const char *fname);
 extern dosaddr_t is_dos_device8(const char *fname);
 extern BOOL do_fwd_mangled_map(char *s, char *MangledMap);
 extern BOOL name_convert(char *Name,BOOL mangle);
+extern void name_mangle_83(char *Name);
 extern BOOL is_mangled(const char *s);
 extern BOOL check_mangled_stack(char *s, char *MangledMap);
 
@@ -196,6 +196,7 @@ TODO:
 #include "share.h"
 #include "xattr.h"
 #include "rlocks.h"
+#include "dircache.h"
 #include "mfs.h"
 
 #ifdef __linux__
@@ -890,6 +891,7 @@ void mfs_done(void)
     if (f->name)
       mfs_close(f);
   }
+  dircache_flush();
 }
 
 void mfs_reset(void)
@@ -1032,13 +1034,22 @@ void extract_filename(const char *filename, char *name, char *ext)
 
 static struct dir_list *make_dir_list(int n)
 {
-  struct dir_list *dir_list = malloc(sizeof(*dir_list));
+  struct dir_list *dir_list = calloc(1, sizeof(*dir_list));
   dir_list->size = n;
   dir_list->nr_entries = 0;
   dir_list->de = malloc(n * sizeof(dir_list->de[0]));
   return dir_list;
 }
 
+static void free_dir_list(struct dir_list *dir_list)
+{
+  if (dir_list->dir)
+    dos_closedir(dir_list->dir);
+  free(dir_list->ino_hash);
+  free(dir_list->de);
+  free(dir_list);
+}
+
 static void enlarge_dir_list(struct dir_list *dir_list, int n)
 {
   dir_list->size = n;
@@ -1066,7 +1077,7 @@ static struct dir_ent *make_entry(struct dir_list *dir_list)
     enlarge_dir_list(dir_list, dir_list->size * 2);
   entry = &dir_list->de[dir_list->nr_entries];
   dir_list->nr_entries++;
-  entry->long_path = FALSE;
+  entry->ino = 0;
   return entry;
 }
 
@@ -1163,6 +1174,118 @@ static int convert_compare(const char *d_name, char *fname, char *fext,
   return compare(fname, fext, mname, mext);
 }
 
+/* Returns TRUE if the entry with that inode was already listed under
+   a name that no longer exists, i.e. it was renamed while the search
+   was in progress and should not be returned twice. Hard links are
+   still listed. */
+static int renamed_entry(struct dir_list *dir_list, const char *name,
+    ino_t ino)
+{
+  unsigned i, mask;
+
+  if (!ino)
+    return FALSE;
+  if (dir_list->ino_hash_size < dir_list->nr_entries * 2 + 2) {
+    int j;
+    free(dir_list->ino_hash);
+    dir_list->ino_hash_size = dir_list->ino_hash_size ?
+        dir_list->ino_hash_size * 2 : 64;
+    while (dir_list->ino_hash_size < dir_list->nr_entries * 2 + 2)
+      dir_list->ino_hash_size *= 2;
+    dir_list->ino_hash = malloc(dir_list->ino_hash_size *
+        sizeof(dir_list->ino_hash[0]));
+    memset(dir_list->ino_hash, 0xff, dir_list->ino_hash_size *
+        sizeof(dir_list->ino_hash[0]));
+    mask = dir_list->ino_hash_size - 1;
+    for (j = 0; j < dir_list->nr_entries; j++) {
+      if (!dir_list->de[j].ino)
+        continue;
+      for (i = dir_list->de[j].ino & mask; dir_list->ino_hash[i] != -1;
+          i = (i + 1) & mask);
+      dir_list->ino_hash[i] = j;
+    }
+  }
+  mask = dir_list->ino_hash_size - 1;
+  for (i = ino & mask; dir_list->ino_hash[i] != -1; i = (i + 1) & mask) {
+    const struct dir_ent *de = &dir_list->de[dir_list->ino_hash[i]];
+    char buf[PATH_MAX];
+    struct stat st;
+
+    if (de->ino != ino)
+      continue;
+    snprintf(buf, sizeof(buf), "%s/%s", name, de->d_name);
+    if (lstat(buf, &st) != 0 || st.st_ino != ino) {
+      Debug0((dbg_fd, "get_dir(): %s renamed, skipping\n", de->d_name));
+      return TRUE;
+    }
+  }
+  /* the caller adds the entry right away */
+  dir_list->ino_hash[i] = dir_list->nr_entries;
+  return FALSE;
+}
+
+/* close the directory of a search that is not used for a while,
+   dir_list_read() opens it again at the same position when needed */
+static void dir_list_park(struct dir_list *dir_list)
+{
+  if (!dir_list->dir)
+    return;
+  dir_list->dir_nr = dir_list->dir->nr;
+  dos_closedir(dir_list->dir);
+  dir_list->dir = NULL;
+}
+
+static int dir_list_unpark(struct dir_list *dir_list, const char *name)
+{
+  struct mfs_dir *dir;
+  unsigned nr = dir_list->dir_nr;
+
+  dir_list->dir_nr = 0;
+  if ((dir = dos_opendir(name)) == NULL)
+    return FALSE;
+  while (dir->nr < nr && dos_readdir(dir));
+  if (dir->nr < nr) {
+    dos_closedir(dir);
+    return FALSE;
+  }
+  dir_list->dir = dir;
+  return TRUE;
+}
+
+/* read directory entries matching the dir_list's wildcard until there
+   are at least n of them. Returns FALSE if the directory ended first. */
+static int dir_list_read(struct dir_list *dir_list, int n, const char *name)
+{
+  struct mfs_dirent *cur_ent;
+  struct dir_ent *entry;
+  char fname[8];
+  char fext[3];
+
+  while (dir_list->nr_entries < n) {
+    if (!dir_list->dir && (!dir_list->dir_nr ||
+        !dir_list_unpark(dir_list, name)))
+      return FALSE;
+    cur_ent = dos_readdir(dir_list->dir);
+    if (!cur_ent) {
+      dos_closedir(dir_list->dir);
+      dir_list->dir = NULL;
+      return FALSE;
+    }
+    Debug0((dbg_fd, "get_dir(): `%s' \n", cur_ent->d_name));
+    if (!convert_compare(cur_ent->d_name, fname, fext, dir_list->mname,
+        dir_list->mext, dir_list->is_root))
+      continue;
+    if (renamed_entry(dir_list, name, cur_ent->d_ino))
+      continue;
+    entry = make_entry(dir_list);
+    strcpy(entry->d_name, cur_ent->d_name);
+    entry->ino = cur_ent->d_ino;
+    memcpy(entry->name, fname, 8);
+    memcpy(entry->ext, fext, 3);
+  }
+  return TRUE;
+}
+
 /* get directory;
    name = UNIX directory name
    mname = DOS (uppercase) name to match (can have wildcards)
@@ -1173,12 +1296,9 @@ static struct dir_list *get_dir_ff(char *name, char *mname, char *mext,
 	int drive)
 {
   struct mfs_dir *cur_dir;
-  struct mfs_dirent *cur_ent;
   struct dir_list *dir_list;
   struct dir_ent *entry;
   char buf[256];
-  char fname[8];
-  char fext[3];
 
   if ((cur_dir = dos_opendir(name)) == NULL) {
     Debug0((dbg_fd, "get_dir(): couldn't open '%s' errno = %s\n", name, strerror(errno)));
@@ -1234,21 +1354,16 @@ static struct dir_list *get_dir_ff(char *name, char *mname, char *mext,
     dos_closedir(cur_dir);
     return (dir_list);
   }
-  else {
-    int is_root = (strlen(name) == drives[drive].root_len);
-    while ((cur_ent = dos_readdir(cur_dir))) {
-      Debug0((dbg_fd, "get_dir(): `%s' \n", cur_ent->d_name));
-      if (!convert_compare(cur_ent->d_name, fname, fext, mname, mext, is_root))
-	continue;
-      if (dir_list == NULL)
-	dir_list = make_dir_list(20);
-      entry = make_entry(dir_list);
-      strcpy(entry->d_name, cur_ent->d_name);
-      memcpy(entry->name, fname, 8);
-      memcpy(entry->ext, fext, 3);
-    }
+  /* the rest is read on demand, see dir_list_read() */
+  dir_list = make_dir_list(20);
+  dir_list->dir = cur_dir;
+  memcpy(dir_list->mname, mname, 8);
+  memcpy(dir_list->mext, mext, 3);
+  dir_list->is_root = (strlen(name) == drives[drive].root_len);
+  if (!dir_list_read(dir_list, 1, name)) {
+    free_dir_list(dir_list);
+    return NULL;
   }
-  dos_closedir(cur_dir);
   return (dir_list);
 }
 
@@ -1266,6 +1381,7 @@ static struct dir_list *get_dir(char *name, char *mname, char *mext, int drive)
   list = get_dir_ff(name, mname, mext, drive);
   if (!list)
     return NULL;
+  while (dir_list_read(list, list->nr_entries + 1, name));
   for (i = 0; i < list->nr_entries; i++) {
     if (signal_pending())
 	coopth_yield();
@@ -1555,12 +1671,14 @@ struct mfs_dirent *dos_readdir(struct mfs_dir *dir)
 {
   if (dir->nr <= 1) {
     dir->de.d_name = dir->de.d_long_name = dir->nr ? ".." : ".";
+    dir->de.d_ino = 0;
   } else do {
     if (dir->dir) {
       struct direct *de = (struct direct *) readdir(dir->dir);
       if (de == NULL)
 	return NULL;
       dir->de.d_name = dir->de.d_long_name = de->d_name;
+      dir->de.d_ino = de->d_ino;
     } else {
 #ifdef __linux__
       static struct __fat_dirent de[2];
@@ -1572,6 +1690,7 @@ struct mfs_dirent *dos_readdir(struct mfs_dir *dir)
 
       dir->de.d_name = de[0].d_name;
       dir->de.d_long_name = de[1].d_name;
+      dir->de.d_ino = de[0].d_ino;
       if (dir->de.d_long_name[0] == '\0' ||
 	  vfat_ioctl == VFAT_IOCTL_READDIR_SHORT) {
         dir->de.d_long_name = dir->de.d_name;
@@ -1834,14 +1953,21 @@ scan_dir(const char *path, char *name, int root_len)
       (dosname[1] == '\0' || strcmp(dosname, "..") == 0))
     return (FALSE);
 
+  strupperDOS(dosname);
+
+  switch (dircache_find(path, name, dosname, is_8_3, maybe_mangled)) {
+  case 1:
+    return (TRUE);
+  case 0:
+    goto not_found;
+  }
+
   /* open the directory */
   if ((cur_dir = dos_opendir(path)) == NULL) {
     Debug0((dbg_fd, "scan_dir(): failed to open dir: %s\n", path));
     return (FALSE);
   }
 
-  strupperDOS(dosname);
-
   /* now scan for matching names */
   while ((cur_ent = dos_readdir(cur_dir))) {
     char tmpname[NAME_MAX + 1];
@@ -1878,6 +2004,7 @@ scan_dir(const char *path, char *name, int root_len)
 
   dos_closedir(cur_dir);
 
+not_found:
   if (MANGLE && is_mangled(name))
     check_mangled_stack(name,NULL);
 
@@ -2020,22 +2147,6 @@ compare(char *fname, char *fext, char *mname, char *mext)
   return (TRUE);
 }
 
-/* Set the long_path flag for every directory on a dir_ent list.
-   Called on FIND_FIRST when we are in a directory with a long
-   pathname. The potentially dangerous subdirectories can then be
-   handled properly.*/
-static void set_long_path_on_dirs(struct dir_list *dir_list)
-{
-  int i;
-  struct dir_ent *list = &dir_list->de[0];
-  for (i = 0; i < dir_list->nr_entries; i++) {
-    if (S_ISDIR(list->mode)) {
-      list->long_path = TRUE;
-    }
-    list++;
-  }
-}
-
 static int
 is_long_path(const char* path)
 {
@@ -2055,6 +2166,7 @@ struct stack_entry
 };
 
 #define HLIST_WATCH_CNT 64	/* if more than HWC hlist positions then ... */
+#define HLIST_OPEN_DIRS 16	/* searches keeping their directory open */
 
 static struct
 {
@@ -2079,8 +2191,7 @@ static void free_list(struct stack_entry *se, int force)
   if (list == NULL)
     return;
 
-  free(list->de);
-  free(list);
+  free_dir_list(list);
   se->hlist = NULL;
 }
 
@@ -2194,6 +2305,30 @@ static inline void hlist_pop_psp(unsigned psp)
 }
 
 
+/*
+ * Each unfinished search holds its directory open. Close the one of
+ * the least recently used search before a new one opens, so that only
+ * HLIST_OPEN_DIRS of them are kept open.
+ */
+static void hlist_park_oldest(void)
+{
+  struct stack_entry *se, *se_old = NULL;
+  int cnt = 0;
+
+  for (se = hlists.stack; se < &hlists.stack[hlists.tos]; se++) {
+    if (se->hlist == NULL || se->hlist->dir == NULL)
+      continue;
+    cnt++;
+    if (se_old == NULL || se->seq < se_old->seq)
+      se_old = se;
+  }
+  if (cnt >= HLIST_OPEN_DIRS) {
+    Debug0((dbg_fd, "hlist_park_oldest: parking ind=%td\n",
+						se_old - hlists.stack));
+    dir_list_park(se_old->hlist);
+  }
+}
+
 static inline void hlist_watch_pop(unsigned psp)
 {
   int act_seq = hlists.seq;
@@ -2232,6 +2367,8 @@ static inline void hlist_watch_pop(unsigned psp)
     se->seq = -1; /* done */
   }
 
+  hlist_park_oldest();
+
   /* shrinking hlists.stack.hlist if is possible
    */
   se = &hlists.stack[hlists.tos];
@@ -2874,7 +3011,8 @@ static int find_again(int firstfind, int drive, char *fpath,
 
   attr = sdb_attribute(sdb);
 
-  while (sdb_dir_entry(sdb) < hlist->nr_entries) {
+  while (sdb_dir_entry(sdb) < hlist->nr_entries ||
+      dir_list_read(hlist, sdb_dir_entry(sdb) + 1, fpath)) {
     de = &hlist->de[sdb_dir_entry(sdb)];
     sdb_dir_entry(sdb)++;
     Debug0((dbg_fd, "find_again entered with %.8s.%.3s\n", de->name, de->ext));
@@ -2886,7 +3024,7 @@ static int find_again(int firstfind, int drive, char *fpath,
       if (!(attr & DIRECTORY)) {
 	continue;
       }
-      if (de->long_path
+      if (hlist->long_path
 	  && strncmp(de->name, ".       ", 8)
 	  && strncmp(de->name, "..      ", 8)) {
 	/* Path is long, so we do not allow subdirectories
@@ -2907,7 +3045,7 @@ static int find_again(int firstfind, int drive, char *fpath,
 	    sdb_file_name(sdb),
 	    sdb_file_ext(sdb), hlist_index));
 
-    if (sdb_dir_entry(sdb) >= hlist->nr_entries)
+    if (!dir_list_read(hlist, sdb_dir_entry(sdb) + 1, fpath))
       hlist_pop(hlist_index, sda_cur_psp(sda));
     return (TRUE);
   }
@@ -3186,6 +3324,170 @@ static void update_seek_from_dos(uint32_t seek_from_dos, uint64_t* p_seek) {
   }
 }
 
+/* Small sequential reads and writes are served from a per-handle
+ * buffer. This is only done when the share mode guarantees nobody
+ * else accesses the file behind our back: DENY_WRITE for read-ahead,
+ * DENY_ALL for delayed writes. Delayed writes are flushed before any
+ * other redirector or LFN call, so the host file is up to date for
+ * stat() and friends. If that fails, the error is kept with the handle
+ * and returned by its next write, commit or close. */
+#define IOBUF_SIZE 16384
+/* larger requests go to the file directly */
+#define IOBUF_SMALL 4096
+
+static int iobuf_users;
+static int iobuf_dirty_cnt;
+
+static int can_read_ahead(const struct file_fd *f)
+{
+  return f->type == TYPE_DISK && S_ISREG(f->st.st_mode) &&
+      (f->share_mode == DENY_ALL || f->share_mode == DENY_WRITE);
+}
+
+static int can_write_behind(const struct file_fd *f)
+{
+  return f->type == TYPE_DISK && S_ISREG(f->st.st_mode) &&
+      f->share_mode == DENY_ALL;
+}
+
+static void iobuf_alloc(struct file_fd *f)
+{
+  if (f->iobuf)
+    return;
+  f->iobuf = malloc(IOBUF_SIZE);
+  iobuf_users++;
+}
+
+static int iobuf_flush(struct file_fd *f)
+{
+  int len = f->iobuf_len, ret;
+
+  if (!f->iobuf_dirty)
+    return 0;
+  f->iobuf_dirty = 0;
+  f->iobuf_len = 0;
+  iobuf_dirty_cnt--;
+  ret = RPT_SYSCALL(pwrite(f->fd, f->iobuf, len, f->iobuf_pos));
+  if (ret != len) {
+    f->iobuf_err = (ret == -1 ? errno : ENOSPC);
+    error("MFS: delayed write to %s failed: %s\n", f->name,
+        strerror(f->iobuf_err));
+    return -1;
+  }
+  return 0;
+}
+
+/* returns -1 with errno set once for a failed delayed write */
+static int iobuf_error(struct file_fd *f)
+{
+  if (!f->iobuf_err)
+    return 0;
+  errno = f->iobuf_err;
+  f->iobuf_err = 0;
+  return -1;
+}
+
+void mfs_iobuf_release(struct file_fd *f)
+{
+  iobuf_flush(f);
+  f->iobuf_len = 0;
+  if (!f->iobuf)
+    return;
+  free(f->iobuf);
+  f->iobuf = NULL;
+  iobuf_users--;
+}
+
+void mfs_iobuf_flush_all(void)
+{
+  int i;
+
+  for (i = 0; i < MAX_OPENED_FILES && iobuf_dirty_cnt; i++) {
+    if (open_files[i].name && open_files[i].iobuf_dirty)
+      iobuf_flush(&open_files[i]);
+  }
+}
+
+/* drop buffers of other handles to the file f is going to modify */
+static void iobuf_drop_others(struct file_fd *f)
+{
+  int i;
+
+  if (!iobuf_users || (iobuf_users == 1 && f->iobuf))
+    return;
+  for (i = 0; i < MAX_OPENED_FILES; i++) {
+    struct file_fd *g = &open_files[i];
+    if (g == f || !g->name || !g->iobuf_len || g->type != TYPE_DISK ||
+        g->st.st_dev != f->st.st_dev || g->st.st_ino != f->st.st_ino)
+      continue;
+    Debug0((dbg_fd, "dropping buffer of handle %i\n", g->idx));
+    iobuf_flush(g);
+    g->iobuf_len = 0;
+  }
+}
+
+static int mfs_read(struct file_fd *f, unsigned dta, int cnt)
+{
+  int ret;
+
+  /* the error of a delayed write is left for the next write */
+  iobuf_flush(f);
+  if (f->iobuf_len && f->seek >= f->iobuf_pos &&
+      f->seek + cnt <= f->iobuf_pos + f->iobuf_len) {
+    memcpy_2dos(dta, f->iobuf + (f->seek - f->iobuf_pos), cnt);
+    return cnt;
+  }
+  f->iobuf_len = 0;
+  if (cnt < IOBUF_SMALL && can_read_ahead(f)) {
+    iobuf_alloc(f);
+    ret = RPT_SYSCALL(pread(f->fd, f->iobuf, IOBUF_SIZE, f->seek));
+    if (ret >= 0) {
+      f->iobuf_pos = f->seek;
+      f->iobuf_len = ret;
+      ret = _min(ret, cnt);
+      memcpy_2dos(dta, f->iobuf, ret);
+      return ret;
+    }
+  }
+  ret = dos_pread(f->fd, dta, cnt, f->seek);
+  if (ret == -1 && errno == ESPIPE)
+    ret = dos_read(f->fd, dta, cnt);
+  return ret;
+}
+
+static int mfs_write(struct file_fd *f, unsigned dta, int cnt)
+{
+  int ret;
+
+  if (iobuf_error(f))
+    return -1;
+  iobuf_drop_others(f);
+  if (cnt < IOBUF_SMALL && can_write_behind(f)) {
+    if (f->iobuf_dirty && f->seek == f->iobuf_pos + f->iobuf_len &&
+        f->iobuf_len + cnt <= IOBUF_SIZE) {
+      memcpy_2unix(f->iobuf + f->iobuf_len, dta, cnt);
+      f->iobuf_len += cnt;
+      return cnt;
+    }
+    if (iobuf_flush(f))
+      return iobuf_error(f);
+    iobuf_alloc(f);
+    memcpy_2unix(f->iobuf, dta, cnt);
+    f->iobuf_pos = f->seek;
+    f->iobuf_len = cnt;
+    f->iobuf_dirty = 1;
+    iobuf_dirty_cnt++;
+    return cnt;
+  }
+  if (iobuf_flush(f))
+    return iobuf_error(f);
+  f->iobuf_len = 0;
+  ret = dos_pwrite(f->fd, dta, cnt, f->seek);
+  if (ret == -1 && errno == ESPIPE)
+    ret = dos_write(f->fd, dta, cnt);
+  return ret;
+}
+
 static struct file_fd *do_open_prn(const char *filename1, const char *fpath)
 {
     int fd;
@@ -3256,6 +3558,9 @@ static int dos_fs_redirect(struct vm86_regs *state, char *stk)
   if (select_drive(state, &drive) == DRV_NOT_FOUND)
     return REDIRECT;
 
+  if (LOW(state->eax) != READ_FILE && LOW(state->eax) != WRITE_FILE)
+    mfs_iobuf_flush_all();
+
   filename1 = sda_filename1(sda);
   filename2 = sda_filename2(sda);
   sdb = sda_sdb(sda);
@@ -3340,10 +3645,15 @@ static int dos_fs_redirect(struct vm86_regs *state, char *stk)
         Debug0((dbg_fd, "Still more handles\n"));
         return TRUE;
       }
+      ret = TRUE;
       if (f->type == TYPE_PRINTER) {
         printer_close(f->fd);
         Debug0((dbg_fd, "printer %i closed\n", f->fd));
       } else {
+        /* the data of a failed delayed write is lost */
+        iobuf_flush(f);
+        if (iobuf_error(f))
+          ret = FALSE;
         mfs_close(f);
       }
 
@@ -3367,7 +3677,9 @@ static int dos_fs_redirect(struct vm86_regs *state, char *stk)
         Debug0((dbg_fd, "close: not setting file date/time\n"));
       }
 
-      return TRUE;
+      if (!ret)
+        SETWORD(&state->eax, ACCESS_DENIED);
+      return ret;
 
     case READ_FILE: { /* 0x08 */
       int return_val;
@@ -3387,7 +3699,10 @@ static int dos_fs_redirect(struct vm86_regs *state, char *stk)
       cnt = WORD(state->ecx);
       if (cnt) {
         int cnt1 = cnt;
-        if (!region_is_fully_owned(f->fd, f->seek, cnt, 0, f->mlemu_fds[1]) &&
+        /* with DENY_ALL nobody else can hold a conflicting lock */
+        if (f->share_mode != DENY_ALL &&
+            !region_is_fully_owned(f->fd, f->seek, cnt, 0, f->mlemu_fds[1],
+                &f->rlock_cache) &&
             f->seek <= 0xFFFFffff && f->seek + cnt <= 0xFFFFffff) {
 #if 1
           /* Since we know the region is not fully locked by us (owned),
@@ -3423,16 +3738,9 @@ static int dos_fs_redirect(struct vm86_regs *state, char *stk)
       Debug0((dbg_fd, "Read file fd=%d, dta=%#x, cnt=%d\n", f->fd, dta, cnt));
       Debug0((dbg_fd, "Read file pos = %"PRIu64"\n", f->seek));
       Debug0((dbg_fd, "Handle cnt %d\n", sft_handle_cnt(sft)));
-      s_pos = lseek(f->fd, f->seek, SEEK_SET);
-      if (s_pos < 0 && errno != ESPIPE) {
-        if (locked)
-          region_unlock_offs(f->fd);
-        SETWORD(&state->ecx, 0);
-        return TRUE;
-      }
-      Debug0((dbg_fd, "Actual pos %"PRIu64"\n", (uint64_t)s_pos));
+      s_pos = f->seek;
 
-      ret = dos_read(f->fd, dta, cnt);
+      ret = mfs_read(f, dta, cnt);
       if (locked)
         region_unlock_offs(f->fd);
 
@@ -3487,7 +3795,9 @@ static int dos_fs_redirect(struct vm86_regs *state, char *stk)
 
       if (!cnt) {
         Debug0((dbg_fd, "Applying O_TRUNC at %x\n", (int)s_pos));
-        if (ftruncate(f->fd, (off_t)f->seek)) {
+        iobuf_drop_others(f);
+        mfs_iobuf_release(f);
+        if (iobuf_error(f) || ftruncate(f->fd, (off_t)f->seek)) {
           Debug0((dbg_fd, "O_TRUNC failed\n"));
           SETWORD(&state->eax, ACCESS_DENIED);
           return FALSE;
@@ -3497,7 +3807,9 @@ static int dos_fs_redirect(struct vm86_regs *state, char *stk)
         SETWORD(&state->ecx, 0);
       } else {
         int cnt1 = cnt;
-        if (!region_is_fully_owned(f->fd, f->seek, cnt, 1, f->mlemu_fds[1]) &&
+        if (f->share_mode != DENY_ALL &&
+            !region_is_fully_owned(f->fd, f->seek, cnt, 1, f->mlemu_fds[1],
+                &f->rlock_cache) &&
             f->seek <= 0xFFFFffff && f->seek + cnt <= 0xFFFFffff) {
           cnt1 = region_lock_offs(f->fd, f->seek, cnt, 1);
           if (cnt1 > 0)
@@ -3521,17 +3833,11 @@ static int dos_fs_redirect(struct vm86_regs *state, char *stk)
         if (cnt1 != -1)
           cnt = cnt1;
 
-        s_pos = lseek(f->fd, f->seek, SEEK_SET);
-        if (s_pos < 0 && errno != ESPIPE) {
-          if (locked)
-            region_unlock_offs(f->fd);
-          SETWORD(&state->ecx, 0);
-          return TRUE;
-        }
+        s_pos = f->seek;
         Debug0((dbg_fd, "Handle cnt %d\n", sft_handle_cnt(sft)));
         Debug0((dbg_fd, "fsize = %"PRIx64", fseek = %"PRIx64", dta = %#x, cnt = %x\n",
                       f->size, f->seek, dta, (int)cnt));
-        ret = dos_write(f->fd, dta, cnt);
+        ret = mfs_write(f, dta, cnt);
         if (locked)
           region_unlock_offs(f->fd);
 
@@ -3552,7 +3858,9 @@ static int dos_fs_redirect(struct vm86_regs *state, char *stk)
       }
       //    sft_abs_cluster(sft) = 0x174a;	/* XXX a test */
       /* update stat for atime/mtime */
-      if (fstat(f->fd, &f->st) == 0)
+      if (f->iobuf_dirty)
+        time_to_dos(time(NULL), &sft_date(sft), &sft_time(sft));
+      else if (fstat(f->fd, &f->st) == 0)
         time_to_dos(f->st.st_mtime, &sft_date(sft), &sft_time(sft));
       return TRUE;
     }
@@ -3730,8 +4038,7 @@ static int dos_fs_redirect(struct vm86_regs *state, char *stk)
         strcpy(fpath + cnt, de->d_name);
         ret |= dos_rename(fpath, filename2, drive);
       }
-      free(dir_list->de);
-      free(dir_list);
+      free_dir_list(dir_list);
       if (ret) {
         SETWORD(&state->eax, ret);
         return FALSE;
@@ -3806,13 +4113,11 @@ static int dos_fs_redirect(struct vm86_regs *state, char *stk)
           } else {
             SETWORD(&state->eax, FILE_NOT_FOUND);
           }
-          free(dir_list->de);
-          free(dir_list);
+          free_dir_list(dir_list);
           return FALSE;
         }
       }
-      free(dir_list->de);
-      free(dir_list);
+      free_dir_list(dir_list);
       return TRUE;
     }
 
@@ -4071,10 +4376,13 @@ do_create_truncate:
         return FALSE;
       }
 
-      if (long_path) {
-        set_long_path_on_dirs(hlist);
-      }
+      hlist->long_path = long_path;
       hlist_index = hlist_push(hlist, sda_cur_psp(sda), fpath);
+      if (hlist_index < 0) {
+        free_dir_list(hlist);
+        SETWORD(&state->eax, NO_MORE_FILES);
+        return FALSE;
+      }
       sdb_dir_entry(sdb) = 0;
       sdb_p_cluster(sdb) = hlist_index;
 
@@ -4221,8 +4529,10 @@ do_create_truncate:
       if ((start & mask) != 0)
         start = (start & ~mask) | ((start & mask) >> 2);
 
+      if (is_lock)
+        mfs_open_mlemu(f);
       ret = lock_file_region(f->fd, is_lock, start, pt->size & ~mask,
-          f->is_writable, f->mlemu_fds[0]);
+          f->is_writable, f->mlemu_fds[0], &f->rlock_cache);
       if (ret == 0) {
         /* locks can be coalesced so the single unlock resets the counter */
         if (is_lock)
@@ -4286,7 +4596,7 @@ do_create_truncate:
       if (cnt >= MAX_OPENED_FILES)
           return FALSE;
       f = &open_files[cnt];
-      if (f->name == NULL) {
+      if (f->name == NULL || iobuf_error(f)) {
         SETWORD(&state->eax, ACCESS_DENIED);
         return FALSE;
       }
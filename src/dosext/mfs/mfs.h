@@ -7,6 +7,7 @@ Andrew.Tridgell@anu.edu.au 30th March 1993
 #include <sys/stat.h>
 #include <dirent.h>
 #include <utime.h>
+#include "rlocks.h"
 
 /* definitions to make mach emu code compatible with dosemu */
 
@@ -239,8 +240,8 @@ struct dir_ent {
   char name[8];			/* dos name and ext */
   char ext[3];
   char d_name[256];             /* unix name as in readdir */
+  ino_t ino;			/* inode number as in readdir */
   u_short mode;			/* unix st_mode value */
-  u_short long_path;            /* directory has long path */
   uint64_t size;		/* size of file */
   time_t time;			/* st_mtime */
   int attr;
@@ -250,6 +251,15 @@ struct dir_list {
   int nr_entries;
   int size;
   struct dir_ent *de;
+  int long_path;		/* directory has long path */
+  /* the rest is for reading the entries on demand */
+  struct mfs_dir *dir;
+  char mname[8];
+  char mext[3];
+  int is_root;
+  int *ino_hash;		/* entry indexes hashed by inode */
+  unsigned ino_hash_size;
+  unsigned dir_nr;		/* read position of a parked dir, or 0 */
 };
 
 struct dos_name {
@@ -261,6 +271,7 @@ struct mfs_dirent
 {
   const char *d_name;
   const char *d_long_name;
+  ino_t d_ino;
 };
 
 struct mfs_dir
@@ -367,7 +378,16 @@ struct file_fd
   uint64_t seek;
   uint64_t size;
   int lock_cnt;
+  struct rlock_cache rlock_cache;
+  /* read-ahead data, or pending writes if iobuf_dirty is set */
+  char *iobuf;
+  uint64_t iobuf_pos;
+  int iobuf_len;
+  int iobuf_dirty;
+  int iobuf_err;	/* errno of a failed delayed write, not yet reported */
 };
 
 #define MAX_OPENED_FILES 256
 extern struct file_fd open_files[MAX_OPENED_FILES];
+void mfs_iobuf_release(struct file_fd *f);
+void mfs_iobuf_flush_all(void);
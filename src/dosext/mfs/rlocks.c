@@ -85,11 +85,14 @@ static void lock_get(int fd, struct flock *fl)
 }
 
 int lock_file_region(int fd, int lck, long long start,
-    unsigned long len, int wr, int mlemu_fd)
+    unsigned long len, int wr, int mlemu_fd, struct rlock_cache *cache)
 {
   struct flock fl;
   int ret;
 
+  /* our locks change, so does the owned region */
+  cache->valid = 0;
+
   /* make data visible before releasing the lock */
   if (!lck)
     fsync(fd);
@@ -117,10 +120,18 @@ int lock_file_region(int fd, int lck, long long start,
 }
 
 int region_is_fully_owned(int fd, long long start, unsigned long len, int wr,
-    int mlemu_fd2)
+    int mlemu_fd2, struct rlock_cache *cache)
 {
   struct flock fl;
 
+  /* Only our own locks can make the region owned, and others can't
+   * remove them. So the result holds until we change our locks. */
+  if (cache->valid && (cache->wr || !wr) && cache->start <= start &&
+      cache->start + cache->len >= start + len)
+    return 1;
+  if (mlemu_fd2 == -1)
+    return 0;  // nothing locked yet
+
   /* check on mirror fd so rd/wr inverted */
   fl.l_type = wr ? F_RDLCK : F_WRLCK;
   fl.l_start = start;
@@ -132,6 +143,10 @@ int region_is_fully_owned(int fd, long long start, unsigned long len, int wr,
     return 0; // not fully locked
   if (fl.l_start + fl.l_len < start + len)
     return 0; // not fully locked
+  cache->valid = 1;
+  cache->wr = (fl.l_type == F_WRLCK);
+  cache->start = fl.l_start;
+  cache->len = fl.l_len;
   return 1;
 }
 
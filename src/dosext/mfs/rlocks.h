@@ -1,20 +1,28 @@
 #ifndef RLOCKS_H
 #define RLOCKS_H
 
+/* last region found owned by region_is_fully_owned() */
+struct rlock_cache {
+  int valid;
+  int wr;
+  long long start;
+  long long len;
+};
+
 #if HAVE_DECL_F_OFD_SETLK
 
 int lock_file_region(int fd, int lck, long long start,
-    unsigned long len, int wr, int mlemu_fd);
+    unsigned long len, int wr, int mlemu_fd, struct rlock_cache *cache);
 int region_lock_offs(int fd, long long start, unsigned long len,
     int wr);
 void region_unlock_offs(int fd);
 int region_is_fully_owned(int fd, long long start, unsigned long len, int wr,
-    int mlemu_fd2);
+    int mlemu_fd2, struct rlock_cache *cache);
 
 #else
 
 static inline int lock_file_region(int fd, int lck, long long start,
-    unsigned long len, int wr, int mlemu_fd)
+    unsigned long len, int wr, int mlemu_fd, struct rlock_cache *cache)
 {
     return 0;
 }
@@ -30,7 +38,7 @@ static inline void region_unlock_offs(int fd)
 }
 
 static inline int region_is_fully_owned(int fd, long long start,
-    unsigned long len, int wr, int mlemu_fd2)
+    unsigned long len, int wr, int mlemu_fd2, struct rlock_cache *cache)
 {
     return 1;  // locks not implemented, allow everything
 }
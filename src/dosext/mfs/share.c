@@ -33,6 +33,7 @@
 #include "mfs.h"
 #include "xattr.h"
 #include "shlock.h"
+#include "shmshare.h"
 #include "share.h"
 
 #define SHLOCK_DIR "dosemu2_sh"
@@ -40,6 +41,23 @@
 
 enum { compat_lk, noncompat_lk, denyR_lk, denyW_lk, R_lk, W_lk, lk_MAX };
 
+static int shm_inited;
+static int shm_enabled;
+static int shm_exlock_depth;
+
+static int use_shm(void)
+{
+    if (!shm_inited) {
+        shm_inited = 1;
+        if (config.shm_locks) {
+            shm_enabled = (shmshare_init() == 0);
+            if (!shm_enabled)
+                error("MFS: shared memory locks unavailable, using lock files\n");
+        }
+    }
+    return shm_enabled;
+}
+
 static char *prepare_shlock_name(const char *fname)
 {
     char *p;
@@ -65,6 +83,28 @@ static void *apply_exlock(const char *fname)
     return ret;
 }
 
+static void *get_exlock(const char *fname)
+{
+    if (use_shm()) {
+        /* table lock serializes all names at once, so may nest */
+        if (!shm_exlock_depth && shmshare_lock())
+            return NULL;
+        shm_exlock_depth++;
+        return &shm_exlock_depth;
+    }
+    return apply_exlock(fname);
+}
+
+static void put_exlock(void *exlock)
+{
+    if (exlock == &shm_exlock_depth) {
+        if (!--shm_exlock_depth)
+            shmshare_unlock();
+        return;
+    }
+    shlock_close(exlock);
+}
+
 /* for mandatory locks emulation */
 static int open_mlemu(int *r_fds)
 {
@@ -90,6 +130,14 @@ static int open_mlemu(int *r_fds)
     return 0;
 }
 
+/* mirror fds are only needed once the file gets locked */
+int mfs_open_mlemu(struct file_fd *f)
+{
+    if (f->mlemu_fds[0] != -1)
+        return 0;
+    return open_mlemu(f->mlemu_fds);
+}
+
 static int is_locked_shlock(const char *name)
 {
     char *nm = prepare_shlock_name(name);
@@ -127,6 +175,10 @@ struct file_fd *do_claim_fd(const char *name)
     memset(ret->shemu_locks, 0, sizeof(void *) * lk_MAX);
     ret->seek = 0;
     ret->size = 0;
+    ret->iobuf_len = 0;
+    ret->iobuf_dirty = 0;
+    ret->iobuf_err = 0;
+    ret->rlock_cache.valid = 0;
     return ret;
 }
 
@@ -147,7 +199,15 @@ static struct file_fd *do_find_fd(const char *name)
 
 static int file_is_opened(const char *name)
 {
-    int lck = is_locked_shlock(name);
+    int lck;
+
+    if (use_shm()) {
+        struct stat st;
+        if (stat(name, &st) != 0)
+            return -1;
+        return shmshare_find(st.st_dev, st.st_ino, ~0U);
+    }
+    lck = is_locked_shlock(name);
     if (lck)
         return 1;  // locked means already opened
     return access(name, F_OK);
@@ -177,103 +237,141 @@ static void do_lock(const char *fname, int id, void **locks)
     free(lname);
 }
 
-static int open_compat(const char *fname, void **locks)
-{
-    if (is_locked(fname, noncompat_lk))
-        return -1;
-    do_lock(fname, compat_lk, locks);
-    return 0;
-}
-
-static int open_share(const char *fname, int open_mode, int share_mode,
-         void **locks)
+/* get the locks that inhibit the open and the ones it claims */
+static void shemu_masks(int open_mode, int share_mode, unsigned *r_deny,
+        unsigned *r_claim)
 {
     int denyR = (share_mode == DENY_READ || share_mode == DENY_ALL);
     int denyW = (share_mode == DENY_WRITE || share_mode == DENY_ALL);
+    unsigned deny = 0, claim = 0;
+
+    if (!share_mode) {
+        *r_deny = 1 << noncompat_lk;
+        *r_claim = 1 << compat_lk;
+        return;
+    }
     /* inhibit compat mode */
-    if (is_locked(fname, compat_lk))
-        return -1;
+    deny |= 1 << compat_lk;
+    claim |= 1 << noncompat_lk;
     if (open_mode != O_WRONLY) {
         /* read mode allowed? */
-        if (is_locked(fname, denyR_lk))
-            return -1;
+        deny |= 1 << denyR_lk;
+        claim |= 1 << R_lk;
     }
     if (open_mode == O_WRONLY || open_mode == O_RDWR) {
         /* write mode allowed? */
-        if (is_locked(fname, denyW_lk))
-            return -1;
+        deny |= 1 << denyW_lk;
+        claim |= 1 << W_lk;
     }
     if (denyR) {
         /* denyR allowed? */
-        if (is_locked(fname, R_lk))
-            return -1;
+        deny |= 1 << R_lk;
+        claim |= 1 << denyR_lk;
     }
     if (denyW) {
         /* denyW allowed? */
-        if (is_locked(fname, W_lk))
-            return -1;
+        deny |= 1 << W_lk;
+        claim |= 1 << denyW_lk;
     }
+    *r_deny = deny;
+    *r_claim = claim;
+}
+
+static int open_shemu(const char *fname, unsigned deny, unsigned claim,
+         void **locks)
+{
+    int i;
 
+    for (i = 0; i < lk_MAX; i++) {
+        if ((deny & (1 << i)) && is_locked(fname, i))
+            return -1;
+    }
     /* all checks passed, claim our locks */
-    do_lock(fname, noncompat_lk, locks);
-    if (open_mode != O_WRONLY)
-        do_lock(fname, R_lk, locks);
-    if (open_mode == O_WRONLY || open_mode == O_RDWR)
-        do_lock(fname, W_lk, locks);
-    if (denyR)
-        do_lock(fname, denyR_lk, locks);
-    if (denyW)
-        do_lock(fname, denyW_lk, locks);
+    for (i = 0; i < lk_MAX; i++) {
+        if (claim & (1 << i))
+            do_lock(fname, i, locks);
+    }
     return 0;
 }
 
+static void close_shemu(void **locks)
+{
+    int i;
+
+    for (i = 0; i < lk_MAX; i++) {
+        if (locks[i])
+            shlock_close(locks[i]);
+    }
+}
+
+/* should be called under exlock */
+static void *claim_shlock(int fd, const char *fname, int open_mode,
+        int share_mode, void **locks)
+{
+    unsigned deny, claim;
+    void *shlock;
+
+    shemu_masks(open_mode, share_mode, &deny, &claim);
+    if (use_shm()) {
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+            return NULL;
+        if (shmshare_find(st.st_dev, st.st_ino, deny))
+            return NULL;
+        return shmshare_claim(st.st_dev, st.st_ino, claim);
+    }
+    if (open_shemu(fname, deny, claim, locks))
+        return NULL;
+    shlock = apply_shlock(fname);
+    if (!shlock)
+        close_shemu(locks);
+    return shlock;
+}
+
+static void release_shlock(struct file_fd *f)
+{
+    if (use_shm()) {
+        shmshare_release(f->shlock);
+        return;
+    }
+    shlock_close(f->shlock);
+    close_shemu(f->shemu_locks);
+}
+
 static int do_mfs_open(struct file_fd *f, const char *fname,
         int flags, int share_mode, int *r_err)
 {
-    int fd, err, i;
+    int fd;
     void *shlock;
     void *exlock;
     int is_writable = (flags == O_WRONLY || flags == O_RDWR);
 
     *r_err = ACCESS_DENIED;
-    exlock = apply_exlock(fname);
+    exlock = get_exlock(fname);
     if (!exlock)
         return -1;
     fd = open(fname, flags | O_CLOEXEC);
     if (fd == -1)
         goto err;
-    if (!share_mode)
-        err = open_compat(fname, f->shemu_locks);
-    else
-        err = open_share(fname, flags, share_mode, f->shemu_locks);
-    if (err) {
-        *r_err = SHARING_VIOLATION;
-        goto err2;
-    }
-    shlock = apply_shlock(fname);
+    shlock = claim_shlock(fd, fname, flags, share_mode, f->shemu_locks);
     if (!shlock) {
         *r_err = SHARING_VIOLATION;
-        goto err3;
+        goto err2;
     }
-    shlock_close(exlock);
+    put_exlock(exlock);
 
     f->fd = fd;
     f->shlock = shlock;
     f->share_mode = share_mode;
     f->psp = sda_cur_psp(sda);
     f->is_writable = is_writable;
-    open_mlemu(f->mlemu_fds);
+    f->mlemu_fds[0] = f->mlemu_fds[1] = -1;
     return 0;
 
-err3:
-    for (i = 0; i < lk_MAX; i++) {
-        if (f->shemu_locks[i])
-            shlock_close(f->shemu_locks[i]);
-    }
 err2:
     close(fd);
 err:
-    shlock_close(exlock);
+    put_exlock(exlock);
     return -1;
 }
 
@@ -299,43 +397,35 @@ struct file_fd *mfs_open(const char *name, int flags,
 
 static int do_mfs_creat(struct file_fd *f, const char *fname, mode_t mode)
 {
-    int fd, err, i;
+    int fd;
     void *shlock;
     void *exlock;
 
-    exlock = apply_exlock(fname);
+    exlock = get_exlock(fname);
     if (!exlock)
         return -1;
     fd = open(fname, O_RDWR | O_CLOEXEC | O_CREAT | O_TRUNC, mode);
     if (fd == -1)
         goto err;
     /* set compat mode */
-    err = open_compat(fname, f->shemu_locks);
-    if (err)
-        goto err2;
-    shlock = apply_shlock(fname);
+    shlock = claim_shlock(fd, fname, O_RDWR, 0, f->shemu_locks);
     if (!shlock)
-        goto err3;
-    shlock_close(exlock);
+        goto err2;
+    put_exlock(exlock);
 
     f->fd = fd;
     f->shlock = shlock;
     f->share_mode = 0;
     f->psp = sda_cur_psp(sda);
     f->is_writable = 1;
-    open_mlemu(f->mlemu_fds);
+    f->mlemu_fds[0] = f->mlemu_fds[1] = -1;
     return 0;
 
-err3:
-    for (i = 0; i < lk_MAX; i++) {
-        if (f->shemu_locks[i])
-            shlock_close(f->shemu_locks[i]);
-    }
 err2:
     unlink(fname);
     close(fd);
 err:
-    shlock_close(exlock);
+    put_exlock(exlock);
     return -1;
 }
 
@@ -363,24 +453,24 @@ static int do_mfs_unlink(const char *fname, int force)
     int rc;
     void *exlock;
 
-    exlock = apply_exlock(fname);
+    exlock = get_exlock(fname);
     if (!exlock)
         return -1;
     rc = file_is_opened(fname);
     switch (rc) {
         case -1:
-            shlock_close(exlock);
+            put_exlock(exlock);
             return FILE_NOT_FOUND;
         case 0:
             break;
         case 1:
             if (!force) {
-                shlock_close(exlock);
+                put_exlock(exlock);
                 return ACCESS_DENIED;
             }
     }
     rc = unlink(fname);
-    shlock_close(exlock);
+    put_exlock(exlock);
     if (rc)
         return FILE_NOT_FOUND;
     return 0;
@@ -402,24 +492,24 @@ static int do_mfs_setattr(const char *fname, int attr, int force)
     int rc;
     void *exlock;
 
-    exlock = apply_exlock(fname);
+    exlock = get_exlock(fname);
     if (!exlock)
         return -1;
     rc = file_is_opened(fname);
     switch (rc) {
         case -1:
-            shlock_close(exlock);
+            put_exlock(exlock);
             return FILE_NOT_FOUND;
         case 0:
             break;
         case 1:
             if (!force) {
-                shlock_close(exlock);
+                put_exlock(exlock);
                 return ACCESS_DENIED;
             }
     }
     rc = set_dos_xattr(fname, attr);
-    shlock_close(exlock);
+    put_exlock(exlock);
     return rc;
 }
 
@@ -440,37 +530,37 @@ static int do_mfs_rename(const char *fname, const char *fname2, int force)
     void *exlock;
     void *exlock2;
 
-    exlock = apply_exlock(fname);
+    exlock = get_exlock(fname);
     if (!exlock)
         return -1;
     rc = file_is_opened(fname);
     switch (rc) {
         case -1:
-            shlock_close(exlock);
+            put_exlock(exlock);
             return FILE_NOT_FOUND;
         case 0:
             break;
         case 1:
             if (!force) {
-                shlock_close(exlock);
+                put_exlock(exlock);
                 return ACCESS_DENIED;
             }
     }
 
-    exlock2 = apply_exlock(fname2);
+    exlock2 = get_exlock(fname2);
     if (!exlock2)
         goto err2;
     rc = file_is_opened(fname2);
     if (rc != -1) {
         /* dest file exists, do not overwrite */
-        shlock_close(exlock2);
-        shlock_close(exlock);
+        put_exlock(exlock2);
+        put_exlock(exlock);
         return ACCESS_DENIED;
     }
 
     rc = rename(fname, fname2);
-    shlock_close(exlock2);
-    shlock_close(exlock);
+    put_exlock(exlock2);
+    put_exlock(exlock);
     if (rc) {
         perror("rename()");
         return FILE_NOT_FOUND;
@@ -478,7 +568,7 @@ static int do_mfs_rename(const char *fname, const char *fname2, int force)
     return 0;
 
 err2:
-    shlock_close(exlock);
+    put_exlock(exlock);
     return ACCESS_DENIED;
 }
 
@@ -495,14 +585,9 @@ int mfs_rename(char *name, char *name2)
 
 void mfs_close(struct file_fd *f)
 {
-    int i;
-
+    mfs_iobuf_release(f);
     close(f->fd);
-    shlock_close(f->shlock);
-    for (i = 0; i < lk_MAX; i++) {
-        if (f->shemu_locks[i])
-            shlock_close(f->shemu_locks[i]);
-    }
+    release_shlock(f);
     if (f->mlemu_fds[0] != -1)
         close(f->mlemu_fds[0]);
     if (f->mlemu_fds[1] != -1)
@@ -26,5 +26,6 @@ int mfs_unlink(char *name);
 int mfs_setattr(char *name, int attr);
 int mfs_rename(char *name, char *name2);
 void mfs_close(struct file_fd *f);
+int mfs_open_mlemu(struct file_fd *f);
 
 #endif
@@ -0,0 +1,301 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: share modes table in shared memory.
+ *
+ * The lock-file based share emulation creates several files and
+ * directories per open. With many dosemu instances working on the
+ * same files that gets expensive. Here the opens of all instances
+ * are recorded in a single table in a POSIX shm segment instead.
+ * Every record holds the file's dev/ino, the owner's slot and a mask
+ * of the share locks it claims (the meaning of the bits is up to the
+ * caller). The table is protected by a robust process-shared mutex,
+ * so an instance dying with the lock held doesn't block the others.
+ *
+ * An instance owns its slot by holding a fcntl() lock on the slot's
+ * byte of the shm object. The kernel drops it when the instance exits,
+ * whatever pid namespace it runs in, so a record whose slot is not
+ * locked is stale and is dropped when found. A new owner of a slot
+ * drops the records left there by the previous one.
+ */
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "emu.h"
+#include "dosemu_debug.h"
+#include "mfs.h"
+#include "shmshare.h"
+
+#define SHM_NAME "/dosemu2_share"
+#define SHM_MAGIC 0x53484d31
+#define SHM_RECS 8192
+#define SHM_OWNERS 1024
+
+struct shm_rec {
+  dev_t dev;
+  ino_t ino;
+  int owner;
+  unsigned mask;
+  int used;
+};
+
+struct shm_table {
+  uint32_t magic;
+  uint32_t size;
+  pthread_mutex_t mtx;
+  /* all used records are below that index */
+  int nrecs;
+  struct shm_rec recs[SHM_RECS];
+};
+
+static struct shm_table *shm;
+static int shm_fd = -1;
+static int shm_owner = -1;
+
+/* slot locks are past the end of the table */
+static int owner_lock(int owner, int cmd, struct flock *fl)
+{
+  fl->l_type = F_WRLCK;
+  fl->l_whence = SEEK_SET;
+  fl->l_start = sizeof(*shm) + owner;
+  fl->l_len = 1;
+  return fcntl(shm_fd, cmd, fl);
+}
+
+static int rec_alive(const struct shm_rec *r)
+{
+  struct flock fl;
+
+  if (r->owner == shm_owner)
+    return 1;
+  if (owner_lock(r->owner, F_GETLK, &fl) == -1)
+    return 1;
+  return (fl.l_type != F_UNLCK);
+}
+
+static void rec_free(struct shm_rec *r)
+{
+  r->used = 0;
+  while (shm->nrecs && !shm->recs[shm->nrecs - 1].used)
+    shm->nrecs--;
+}
+
+static void sweep_dead(void)
+{
+  int i;
+
+  for (i = 0; i < shm->nrecs; i++) {
+    struct shm_rec *r = &shm->recs[i];
+    if (r->used && !rec_alive(r)) {
+      Debug0((dbg_fd, "shmshare: dropping stale record of slot %i\n",
+          r->owner));
+      rec_free(r);
+    }
+  }
+}
+
+static int table_init(void)
+{
+  pthread_mutexattr_t attr;
+  int err;
+
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  err = pthread_mutex_init(&shm->mtx, &attr);
+  pthread_mutexattr_destroy(&attr);
+  if (err)
+    return -1;
+  shm->nrecs = 0;
+  memset(shm->recs, 0, sizeof(shm->recs));
+  shm->size = sizeof(*shm);
+  /* set last, someone may have died in the middle of the init */
+  shm->magic = SHM_MAGIC;
+  return 0;
+}
+
+static int claim_owner(void)
+{
+  struct flock fl;
+  int i, j;
+
+  for (i = 0; i < SHM_OWNERS; i++) {
+    if (owner_lock(i, F_SETLK, &fl) == 0)
+      break;
+  }
+  if (i == SHM_OWNERS) {
+    error("MFS: too many instances share %s\n", SHM_NAME);
+    return -1;
+  }
+  if (shmshare_lock())
+    return -1;
+  /* left by a previous owner of the slot */
+  for (j = 0; j < shm->nrecs; j++) {
+    struct shm_rec *r = &shm->recs[j];
+    if (r->used && r->owner == i)
+      rec_free(r);
+  }
+  shm_owner = i;
+  shmshare_unlock();
+  return 0;
+}
+
+int shmshare_init(void)
+{
+#ifdef HAVE_SHM_OPEN
+  int fd, err;
+  struct stat st;
+  void *addr;
+
+  fd = shm_open(SHM_NAME, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  if (fd == -1) {
+    perror("shm_open()");
+    return -1;
+  }
+  /* serialize the creation, the table mutex is not there yet */
+  err = flock(fd, LOCK_EX);
+  if (err)
+    goto err_close;
+  err = fstat(fd, &st);
+  if (err)
+    goto err_close;
+  if (!st.st_size) {
+    err = ftruncate(fd, sizeof(*shm));
+    if (err)
+      goto err_close;
+  } else if (st.st_size != sizeof(*shm)) {
+    error("MFS: %s is of incompatible size\n", SHM_NAME);
+    goto err_close;
+  }
+  addr = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    perror("mmap()");
+    goto err_close;
+  }
+  shm = addr;
+  if (shm->magic != SHM_MAGIC || shm->size != sizeof(*shm)) {
+    if (table_init()) {
+      munmap(shm, sizeof(*shm));
+      shm = NULL;
+      goto err_close;
+    }
+  }
+  /* stays open for the slot lock */
+  shm_fd = fd;
+  if (claim_owner()) {
+    munmap(shm, sizeof(*shm));
+    shm = NULL;
+    shm_fd = -1;
+    goto err_close;
+  }
+  flock(fd, LOCK_UN);
+  return 0;
+
+err_close:
+  close(fd);
+#endif
+  return -1;
+}
+
+int shmshare_lock(void)
+{
+  int err = pthread_mutex_lock(&shm->mtx);
+
+  if (err == EOWNERDEAD) {
+    /* previous owner died with the lock held */
+    error("MFS: share table owner died, recovering\n");
+    sweep_dead();
+    pthread_mutex_consistent(&shm->mtx);
+  } else if (err) {
+    /* not held, so the caller must not touch the table */
+    error("MFS: share table lock failed, %s\n", strerror(err));
+    return -1;
+  }
+  return 0;
+}
+
+void shmshare_unlock(void)
+{
+  pthread_mutex_unlock(&shm->mtx);
+}
+
+/* should be called with the table locked */
+int shmshare_find(dev_t dev, ino_t ino, unsigned mask)
+{
+  int i;
+
+  for (i = 0; i < shm->nrecs; i++) {
+    struct shm_rec *r = &shm->recs[i];
+    if (!r->used || r->ino != ino || r->dev != dev || !(r->mask & mask))
+      continue;
+    if (!rec_alive(r)) {
+      rec_free(r);
+      continue;
+    }
+    return 1;
+  }
+  return 0;
+}
+
+static struct shm_rec *get_free_rec(void)
+{
+  int i;
+
+  for (i = 0; i < shm->nrecs; i++) {
+    if (!shm->recs[i].used)
+      return &shm->recs[i];
+  }
+  if (shm->nrecs < SHM_RECS)
+    return &shm->recs[shm->nrecs++];
+  return NULL;
+}
+
+/* should be called with the table locked */
+void *shmshare_claim(dev_t dev, ino_t ino, unsigned mask)
+{
+  struct shm_rec *r = get_free_rec();
+
+  if (!r) {
+    sweep_dead();
+    r = get_free_rec();
+  }
+  if (!r) {
+    error("MFS: share table full\n");
+    return NULL;
+  }
+  r->dev = dev;
+  r->ino = ino;
+  r->owner = shm_owner;
+  r->mask = mask;
+  r->used = 1;
+  return r;
+}
+
+void shmshare_release(void *handle)
+{
+  /* if that fails, the record goes away with this instance */
+  if (shmshare_lock())
+    return;
+  rec_free(handle);
+  shmshare_unlock();
+}
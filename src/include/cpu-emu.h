@@ -69,7 +69,7 @@ extern int IsDpmiEmu;
 
 void enter_cpu_emu(void);
 void leave_cpu_emu(void);
-void avltr_destroy(void);
+void tdir_destroy(void);
 int e_vm86(void);
 
 /* called from dpmi.c */
@@ -77,6 +77,11 @@ void emu_mhp_SetTypebyte (unsigned short selector, int typebyte);
 unsigned short emu_do_LAR (unsigned short selector);
 char *e_scp_disasm(cpuctx_t *scp, int pmode);
 
+/* called from the debugger */
+#ifdef X86_JIT
+void e_cache_stats(void (*print)(const char *, ...));
+#endif
+
 /* called from mfs.c, fatfs.c and some places that memcpy */
 #ifdef X86_JIT
 void e_invalidate(unsigned data, int cnt);
@@ -330,6 +330,8 @@ void show_welcome_screen(void);
 typedef void (*sim_pagefault_handler_t)(dosaddr_t, int, uint32_t op, int);
 void default_sim_pagefault_handler(dosaddr_t addr, int err, uint32_t op, int len);
 void invalidate_unprotected_page_cache(dosaddr_t addr, int len);
+void *dosaddr_to_unixaddr_unprotected(dosaddr_t addr, int len);
+void cache_unprotected_page(dosaddr_t addr);
 uint8_t read_byte(dosaddr_t addr);
 uint16_t read_word(dosaddr_t addr);
 uint32_t read_dword(dosaddr_t addr);
@@ -356,8 +358,10 @@ void memset_dos(dosaddr_t dest, char ch, size_t n);
 
 int unix_read(int fd, void *data, int cnt);
 int dos_read(int fd, unsigned data, int cnt);
+int dos_pread(int fd, unsigned data, int cnt, off_t offs);
 int unix_write(int fd, const void *data, int cnt);
 int dos_write(int fd, unsigned data, int cnt);
+int dos_pwrite(int fd, unsigned data, int cnt, off_t offs);
 int com_vsprintf(char *str, const char *format, va_list ap);
 int com_vsnprintf(char *str, size_t size, const char *format, va_list ap);
 int com_sprintf(char *str, const char *format, ...) FORMAT(printf, 2, 3);
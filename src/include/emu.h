@@ -155,9 +155,13 @@ typedef struct config_info {
        #define EMU_FULL() (EMU_V86() && EMU_DPMI())
        #define IS_EMU() (EMU_V86() || EMU_DPMI())
        boolean cpusim;
+       char *cpuemu_cache;
+       boolean cpuemu_fastfpu;
+       int cpuemu_cachesize;	/* Kbytes of translated code, 0 = no limit */
 #endif
        int cpu_vm;
        int cpu_vm_dpmi;
+       boolean kvm_fastio;
        int CPUSpeedInMhz;
        /* for video */
        int console_video;
@@ -264,6 +268,8 @@ typedef struct config_info {
        int ems_uma_pages, ems_cnv_pages;
        int dpmi, pm_dos_api, no_null_checks;
        uint32_t dpmi_base;
+       boolean huge_pages;
+       boolean dpmi_lazy_commit;
        int dos_up;
 
        int sillyint;            /* IRQ numbers for Silly Interrupt Generator
@@ -288,6 +294,8 @@ typedef struct config_info {
 
        /* LFN support */
        boolean lfn;
+       /* share modes table in shm */
+       boolean shm_locks;
        int int_hooks;
        int force_revect;
        int trace_irets;
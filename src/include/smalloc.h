@@ -36,6 +36,7 @@ typedef struct mempool {
   struct memnode mn;
   int (*commit)(void *area, size_t size);
   int (*uncommit)(void *area, size_t size);
+  int zero_commit;
   void (*smerr)(int prio, const char *fmt, ...) FORMAT(printf, 2, 3);
 } smpool;
 
@@ -61,6 +62,7 @@ size_t smget_free_space(struct mempool *mp);
 size_t smget_largest_free_area(struct mempool *mp);
 int smget_area_size(struct mempool *mp, void *ptr);
 void *smget_base_addr(struct mempool *mp);
+void smset_zero_commit(struct mempool *mp, int on);
 void smregister_error_notifier(struct mempool *mp,
   void (*func)(int prio, const char *fmt, ...) FORMAT(printf, 2, 3));
 void smregister_default_error_notifier(
@@ -63,6 +63,7 @@
 #include "dis8086.h"
 #include "dos2linux.h"
 #include "kvm.h"
+#include "cpu-emu.h"
 #include "Asm/ldt.h"
 
 #define MHP_PRIVATE
@@ -105,6 +106,7 @@ static void mhp_ddrh    (int, char *[]);
 static void mhp_dpbs    (int, char *[]);
 static void mhp_bplog   (int, char *[]);
 static void mhp_bclog   (int, char *[]);
+static void mhp_jit     (int, char *[]);
 
 static void print_log_breakpoints(void);
 static int bpchk(unsigned int a1);
@@ -175,6 +177,7 @@ static const struct cmd_db cmdtab[] = {
    {"devs",          mhp_devs},
    {"ddrh",          mhp_ddrh},
    {"dpbs",          mhp_dpbs},
+   {"jit",           mhp_jit},
    {"",              NULL}
 };
 
@@ -1667,6 +1670,19 @@ static void mhp_dpbs(int argc, char *argv[])
   }
 }
 
+static void mhp_jit(int argc, char *argv[])
+{
+#ifdef X86_JIT
+  if (!IS_EMU_JIT()) {
+    mhp_printf("The jit is not in use\n");
+    return;
+  }
+  e_cache_stats(mhp_printf);
+#else
+  mhp_printf("The jit is not compiled in\n");
+#endif
+}
+
 static void mhp_mode(int argc, char * argv[])
 {
    if (argc >=2) {
@@ -0,0 +1,80 @@
+import re
+
+
+def cpu_fpu_precision(self, fast_fpu):
+    if fast_fpu not in ("on", "off"):
+        raise ValueError('invalid argument')
+
+    config = """
+    $_hdimage = "dXXXXs/c:hdtype1 +1"
+    $_floppy_a = ""
+    $_cpu_vm = "emulated"
+    $_cpuemu_fast_fpu = (%s)
+    """ % fast_fpu
+
+    self.mkfile("testit.bat", """\
+c:\\cpufpupc
+rem end
+""", newline="\r\n")
+
+    # compile sources
+    self.mkcom_with_nasm("cpufpupc", r"""
+
+bits 16
+cpu 386
+
+org 100h
+
+section .text
+
+    push    cs
+    pop     ds
+
+    fninit
+    fldcw   [cw_in]            ; extended precision, round to zero
+    fld1
+    fstp    st0
+
+    mov     ax, 0              ; leave the emulator
+    int     0xe6
+
+    fstcw   [cw_out]
+    fwait
+    mov     ax, [cw_out]
+    cmp     ax, [cw_in]
+    jne     prnt
+    inc     byte [result.cnt]
+
+prnt:
+    mov     ah, 9              ; print string
+    mov     dx, result
+    int     21h
+
+exit:
+    mov     ax, 4c00h
+    int     21h
+    ret
+
+section .data
+
+cw_in:
+    dw 0f7fh
+cw_out:
+    dw 0
+
+result:
+    db "Result is ("
+.cnt:
+    db '0'
+    db ')',13,10,'$'
+""")
+
+    results = self.runDosemu("testit.bat", config=config)
+
+    r1 = re.compile(r'Result is \((\d+)\)')
+    self.assertRegex(results, r1)
+    t = r1.search(results)
+    rval = int(t.group(1), 10)
+
+    # FSTCW must return the precision control the guest loaded
+    self.assertEqual(rval, 1, results)
@@ -0,0 +1,135 @@
+def ds3_lock_denyall(self, fstype, shm_locks=False):
+    testdir = self.mkworkdir('d')
+
+    self.mkfile("testit.bat", """\
+d:
+%s
+c:\\lckdnyal primary
+rem end
+""" % ("rem Internal share" if self.version == "FDPP kernel" else "c:\\share"), newline="\r\n")
+
+        # compile sources
+    self.mkexe_with_djgpp("lckdnyal", r"""
+#include <dos.h>
+#include <dir.h>
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
+#include <share.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FNAME "FOO.DAT"
+#define FDATA "0123456789"
+
+int main(int argc, char *argv[]) {
+
+  int handle;
+  int ret;
+  unsigned rc;
+  char buf[16];
+  int primary = -1;
+
+  if (argc < 2) {
+    printf("FAIL: Missing argument (primary|secondary)\n");
+    return -2;
+  }
+  if (strcmp(argv[1], "primary") == 0)
+    primary = 1;
+  if (strcmp(argv[1], "secondary") == 0)
+    primary = 0;
+  if (primary < 0) {
+    printf("FAIL: Invalid argument (primary|secondary)\n");
+    return -2;
+  }
+
+  if (!primary) {
+    ret = _dos_open(FNAME, O_RDONLY | SH_DENYNO, &handle);
+    if (ret == 0) {
+      printf("FAIL: secondary: Opened file '%s' held with DENY_ALL\n", FNAME);
+      _dos_close(handle);
+      return -1;
+    }
+    printf("OKAY: secondary: Could not open file '%s'\n", FNAME);
+    return 0;
+  }
+
+  ret = _dos_creat(FNAME, _A_NORMAL, &handle);
+  if (ret != 0) {
+    printf("FAIL: File '%s' not created\n", FNAME);
+    return -1;
+  }
+  _dos_write(handle, FDATA, strlen(FDATA), &rc);
+  _dos_close(handle);
+
+  ret = _dos_open(FNAME, O_RDWR | SH_DENYRW, &handle);
+  if (ret != 0) {
+    printf("FAIL: File '%s' not opened with DENY_ALL\n", FNAME);
+    return -1;
+  }
+
+  ret = _dos_lock(handle, 2, 4);
+  if (ret != 0) {
+    printf("FAIL: Could not get lock on file '%s'\n", FNAME);
+    _dos_close(handle);
+    return -1;
+  }
+
+  // the owner of the lock reads and writes it
+  llseek(handle, 2, SEEK_SET);
+  ret = _dos_write(handle, "abcd", 4, &rc);
+  if (ret != 0 || rc != 4) {
+    printf("FAIL: Write to own locked region failed\n");
+    _dos_close(handle);
+    return -1;
+  }
+  llseek(handle, 0, SEEK_SET);
+  ret = _dos_read(handle, buf, 10, &rc);
+  if (ret != 0 || rc != 10 || memcmp(buf, "01abcd6789", 10) != 0) {
+    printf("FAIL: Read of own locked region failed\n");
+    _dos_close(handle);
+    return -1;
+  }
+
+  spawnlp(P_WAIT, argv[0], argv[0], "secondary", NULL);
+
+  ret = _dos_unlock(handle, 2, 4);
+  if (ret != 0) {
+    printf("FAIL: Could not unlock file '%s'\n", FNAME);
+    _dos_close(handle);
+    return -1;
+  }
+  ret = _dos_lock(handle, 3, 1);
+  if (ret != 0) {
+    printf("FAIL: Could not lock the unlocked region\n");
+    _dos_close(handle);
+    return -1;
+  }
+  _dos_unlock(handle, 3, 1);
+  _dos_close(handle);
+
+  printf("PASS: DENY_ALL handle locks, reads and writes\n");
+  return 0;
+}
+""")
+
+    if fstype == "MFS":
+        config="""\
+$_hdimage = "dXXXXs/c:hdtype1 dXXXXs/d:hdtype1 +1"
+$_floppy_a = ""
+"""
+    else:       # FAT
+        name = self.mkimage("12", cwd=testdir)
+        config="""\
+$_hdimage = "dXXXXs/c:hdtype1 %s +1"
+$_floppy_a = ""
+""" % name
+    if shm_locks:
+        config += """$_shm_locks = (on)\n"""
+
+    results = self.runDosemu("testit.bat", config=config)
+
+    self.assertNotIn("FAIL:", results)
+    self.assertIn("OKAY: secondary", results)
+    self.assertIn("PASS:", results)
@@ -1,7 +1,7 @@
 import re
 
 
-def _run_all(self, numprocs, fstype, tests, testtype):
+def _run_all(self, numprocs, fstype, tests, testtype, shm_locks):
     testdir = self.mkworkdir('d')
 
     share = "rem Internal share" if self.version == "FDPP kernel" else "c:\\share"
@@ -382,6 +382,8 @@ int main(int argc, char *argv[]) {
     else:       # FAT
         name = self.mkimage("12", cwd=testdir)
         config += """$_hdimage = "dXXXXs/c:hdtype1 %s +1"\n""" % name
+    if shm_locks:
+        config += """$_shm_locks = (on)\n"""
 
     return self.runDosemu("testit.bat", config=config, timeout=60)
 
@@ -439,7 +441,7 @@ def _check_single_result(self, results, t):
     if m:
         self.fail(msg=m.group(0))
 
-def ds3_share_open_access(self, numprocs, fstype, testtype):
+def ds3_share_open_access(self, numprocs, fstype, testtype, shm_locks=False):
     if numprocs == "ONE":
         tests = TESTS_ONE_PROCESS
     else:         # TWO
@@ -448,7 +450,7 @@ def ds3_share_open_access(self, numprocs, fstype, testtype):
         else:       # FAT
             tests = TESTS_TWO_PROCESS_FAT
 
-    results = _run_all(self, numprocs, fstype, tests, testtype)
+    results = _run_all(self, numprocs, fstype, tests, testtype, shm_locks)
     for t in tests:
         with self.subTest(t=t):
             _check_single_result(self, results, t)
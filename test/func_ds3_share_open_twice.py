@@ -1,7 +1,7 @@
 import re
 
 
-def _run_all(self, fstype, tests):
+def _run_all(self, fstype, tests, shm_locks):
     testdir = self.mkworkdir('d')
 
     share = "rem Internal share" if self.version == "FDPP kernel" else "c:\\share"
@@ -150,6 +150,8 @@ int main(int argc, char *argv[]) {
     else:       # FAT
         name = self.mkimage("12", cwd=testdir)
         config += """$_hdimage = "dXXXXs/c:hdtype1 %s +1"\n""" % name
+    if shm_locks:
+        config += """$_shm_locks = (on)\n"""
 
     return self.runDosemu("testit.bat", config=config, timeout=60)
 
@@ -449,8 +451,8 @@ def _check_single_result(self, results, t):
     if m:
         self.fail(msg=m.group(0))
 
-def ds3_share_open_twice(self, fstype):
-    results = _run_all(self, fstype, OPENTESTS)
+def ds3_share_open_twice(self, fstype, shm_locks=False):
+    results = _run_all(self, fstype, OPENTESTS, shm_locks)
     for t in OPENTESTS:
         with self.subTest(t=t):
             _check_single_result(self, results, t)
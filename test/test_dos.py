@@ -18,12 +18,14 @@ from time import mktime
 from common_framework import (BaseTestCase, get_test_binaries, main, mkstring,
                               IPROMPT, KNOWNFAIL, UNSUPPORTED)
 
+from func_cpu_fpu_precision import cpu_fpu_precision
 from func_cpu_trap_flag import cpu_trap_flag
 from func_ds2_file_seek_tell import ds2_file_seek_tell
 from func_ds2_file_seek_read import ds2_file_seek_read
 from func_ds2_set_fattrs import ds2_set_fattrs
 from func_ds3_file_access import ds3_file_access
 from func_ds3_lock_concurrent import ds3_lock_concurrent
+from func_ds3_lock_denyall import ds3_lock_denyall
 from func_ds3_lock_two_handles import ds3_lock_two_handles
 from func_ds3_lock_readlckd import ds3_lock_readlckd
 from func_ds3_lock_readonly import ds3_lock_readonly
@@ -4590,6 +4592,18 @@ $_floppy_a = ""
         """FAT DOSv3 lock file writable"""
         ds3_lock_writable(self, "FAT")
 
+    def test_mfs_ds3_lock_denyall(self):
+        """MFS DOSv3 lock file opened with deny all"""
+        ds3_lock_denyall(self, "MFS")
+
+    def test_mfs_ds3_lock_denyall_shm(self):
+        """MFS DOSv3 lock file opened with deny all, shm share table"""
+        ds3_lock_denyall(self, "MFS", shm_locks=True)
+
+    def test_fat_ds3_lock_denyall(self):
+        """FAT DOSv3 lock file opened with deny all"""
+        ds3_lock_denyall(self, "FAT")
+
     def test_mfs_ds3_share_open_twice(self):
         """MFS DOSv3 share open twice"""
         ds3_share_open_twice(self, "MFS")
@@ -4598,6 +4612,10 @@ $_floppy_a = ""
         """FAT DOSv3 share open twice"""
         ds3_share_open_twice(self, "FAT")
 
+    def test_mfs_ds3_share_open_twice_shm(self):
+        """MFS DOSv3 share open twice, shm share table"""
+        ds3_share_open_twice(self, "MFS", shm_locks=True)
+
     def test_mfs_ds3_share_open_delete_one_process_ds2(self):
         """MFS DOSv3 share open delete one process DOSv2"""
         ds3_share_open_access(self, "ONE", "MFS", "DELPTH")
@@ -4678,6 +4696,30 @@ $_floppy_a = ""
         """FAT DOSv3 share open set file attrs two process DOSv2"""
         ds3_share_open_access(self, "TWO", "FAT", "SETATT")
 
+    def test_mfs_ds3_share_open_delete_one_process_ds2_shm(self):
+        """MFS DOSv3 share open delete one process DOSv2, shm share table"""
+        ds3_share_open_access(self, "ONE", "MFS", "DELPTH", shm_locks=True)
+
+    def test_mfs_ds3_share_open_delete_two_process_ds2_shm(self):
+        """MFS DOSv3 share open delete two process DOSv2, shm share table"""
+        ds3_share_open_access(self, "TWO", "MFS", "DELPTH", shm_locks=True)
+
+    def test_mfs_ds3_share_open_delete_two_process_fcb_shm(self):
+        """MFS DOSv3 share open delete two process FCB, shm share table"""
+        ds3_share_open_access(self, "TWO", "MFS", "DELFCB", shm_locks=True)
+
+    def test_mfs_ds3_share_open_rename_two_process_ds2_shm(self):
+        """MFS DOSv3 share open rename two process DOSv2, shm share table"""
+        ds3_share_open_access(self, "TWO", "MFS", "RENPTH", shm_locks=True)
+
+    def test_mfs_ds3_share_open_rename_two_process_fcb_shm(self):
+        """MFS DOSv3 share open rename two process FCB, shm share table"""
+        ds3_share_open_access(self, "TWO", "MFS", "RENFCB", shm_locks=True)
+
+    def test_mfs_ds3_share_open_setfattrs_two_process_shm(self):
+        """MFS DOSv3 share open set file attrs two process DOSv2, shm share table"""
+        ds3_share_open_access(self, "TWO", "MFS", "SETATT", shm_locks=True)
+
     def test_network_pktdriver_mtcp_builtin(self):
         """Network pktdriver mTCP built-in"""
         network_pktdriver_mtcp(self, 'builtin')
@@ -4801,6 +4843,16 @@ $_ignore_djgpp_null_derefs = (off)
         cpu_trap_flag(self, 'kvm')
     test_cpu_trap_flag_kvm.cputest = True
 
+    def test_cpu_fpu_precision_exact(self):
+        """CPU FPU precision control across exits"""
+        cpu_fpu_precision(self, 'off')
+    test_cpu_fpu_precision_exact.cputest = True
+
+    def test_cpu_fpu_precision_fast(self):
+        """CPU FPU precision control across exits with fast FPU"""
+        cpu_fpu_precision(self, 'on')
+    test_cpu_fpu_precision_fast.cputest = True
+
     def test_pcmos_build(self):
         """PC-MOS build script"""
         if environ.get("SKIP_EXPENSIVE"):